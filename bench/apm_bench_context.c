@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
+
+//! montagem, serialização e liberação de transações com 100 spans e 5 campos livres de contexto por span, com e sem
+//! atributos tipados misturados
+
+#define SPANS 100
+#define REPS 2000
+
+static apm_config_t config = { .bypass = 0, .name = "bench", .environment = "bench", .url = "http://localhost", .token = "" };
+
+static double apm_bench_now(void);
+static void apm_bench_context(bool attrs);
+
+
+static double apm_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void apm_bench_context(bool attrs)
+{
+    double build = 0, serialize = 0, release = 0;
+    size_t bytes = 0;
+
+    for (int r = 0; r < REPS; r++) {
+        double start = apm_bench_now();
+        apm_transaction_t* transaction = apm_begin_transaction("GET /api/orders", "request", NULL, NULL);
+        for (int i = 0; i < SPANS; i++) {
+            apm_span_t* span = apm_begin_span(transaction, NULL, "GET /inventory", "external", "http");
+            double retries = i % 3;
+            apm_add_str_to_span(span, "inventory", "labels", "service", NULL);
+            apm_add_str_to_span(span, "eu-west-1", "labels", "region", NULL);
+            apm_add_str_to_span(span, "a1b2c3d4e5", "labels", "request_id", NULL);
+            apm_add_int_to_span(span, &retries, "labels", "retries", NULL);
+            apm_add_str_to_span(span, "Mozilla/5.0", "http", "request", "headers", "user_agent", NULL);
+            if (attrs) {
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_HTTP_URL, "http://inventory:8080/items?id=42");
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_HTTP_METHOD, "GET");
+                apm_add_int_attr_to_span(transaction, span, APM_ATTR_HTTP_STATUS_CODE, 200);
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_DESTINATION_SERVICE_RESOURCE, "inventory:8080");
+            }
+            span->captured = true;
+            apm_end_span(transaction, span, SUCCESS);
+        }
+        double built = apm_bench_now();
+
+        apm_payload_t payload;
+        apm_create_payload(transaction, &payload);
+        bytes = payload.len;
+        apm_payload_free(&payload);
+        double serialized = apm_bench_now();
+
+        apm_free_transaction(transaction);
+        double released = apm_bench_now();
+
+        build += built - start;
+        serialize += serialized - built;
+        release += released - serialized;
+    }
+
+    printf("| %-14s | %7zu | %8.0f | %12.0f | %9.0f |\n", attrs ? "campos + attrs" : "campos", bytes,
+           build * 1e9 / (REPS * SPANS), serialize * 1e9 / (REPS * SPANS), release * 1e9 / (REPS * SPANS));
+}
+
+int main(void)
+{
+    apm_init(&config);
+
+    //! tempos em ns por span
+    printf("| spans          | bytes   | montagem | serialização | liberação |\n");
+    printf("|----------------|---------|----------|--------------|-----------|\n");
+    apm_bench_context(false);
+    apm_bench_context(true);
+
+    apm_destroy();
+    return 0;
+}
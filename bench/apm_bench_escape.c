@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <trrapm/apm_escape.h>
+#include <trrapm/apm_ndjson.h>
+#include <trrapm/cJSON.h>
+
+//! ns por string para achar os bytes a escapar (o kernel sozinho e um laço byte a byte de referência) e para escrever
+//! a string escapada no ndjson e no cJSON, em cinco categorias de strings comuns nos eventos
+
+#define STRINGS 20000
+#define CATEGORIES 5
+#define REPS 20
+
+static const char* categories[CATEGORIES] = { "span name 8-40", "url 40-160", "sql 60-400", "stack frame 20-90", "error msg 20-200" };
+static const int min_len[CATEGORIES] = { 8, 40, 60, 20, 20 };
+static const int max_len[CATEGORIES] = { 40, 160, 400, 90, 200 };
+
+static const char* words[] = {
+    "orders", "customer_id", "SELECT", "payments", "/usr/lib/x86_64-linux-gnu/", "libtrrvm.so", "status", "handler",
+    "GET", "api", "v2", "items", "=", "'open'", "WHERE", "JOIN", "src/", ".c", "process_request", "?expand=details",
+};
+
+static char* strings[CATEGORIES][STRINGS];
+static size_t total_len[CATEGORIES];
+
+static double apm_bench_now(void);
+static char* apm_bench_string(int category);
+static const char* apm_bench_scan_reference(const char* s);
+static const char* apm_bench_kernel(void);
+
+
+static double apm_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* apm_bench_string(int category)
+{
+    int len = min_len[category] + rand() % (max_len[category] - min_len[category] + 1);
+    char* s = malloc(len + 1);
+    int i = 0;
+
+    while (i < len) {
+        for (const char* w = words[rand() % 20]; *w && i < len; w++) {
+            s[i++] = *w;
+        }
+        if (i < len) {
+            s[i++] = category == 1 ? '/' : ' ';
+        }
+    }
+    s[len] = '\0';
+
+    //! 20% das queries têm várias linhas e 10% das mensagens de erro têm aspas
+    if (category == 2 && rand() % 5 == 0) {
+        for (int k = 50; k < len; k += 60) {
+            s[k] = '\n';
+        }
+    }
+    if (category == 4 && rand() % 10 == 0) {
+        s[len / 3] = '"';
+        s[2 * len / 3] = '"';
+    }
+    return s;
+}
+
+static const char* apm_bench_scan_reference(const char* s)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    while (*p >= 0x20 && *p != '"' && *p != '\\') {
+        p++;
+    }
+    return (const char*)p;
+}
+
+static const char* apm_bench_kernel(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return "sse2";
+    }
+#endif
+    return "escalar";
+}
+
+int main(void)
+{
+    size_t sink = 0;
+
+    srand(25);
+    for (int c = 0; c < CATEGORIES; c++) {
+        for (int i = 0; i < STRINGS; i++) {
+            strings[c][i] = apm_bench_string(c);
+            total_len[c] += strlen(strings[c][i]);
+        }
+    }
+
+    printf("kernel: %s\n\n", apm_bench_kernel());
+    printf("| strings           | tam. médio | referência | kernel | ndjson | cJSON |\n");
+    printf("|-------------------|------------|------------|--------|--------|-------|\n");
+
+    for (int c = 0; c < CATEGORIES; c++) {
+        double start = apm_bench_now();
+        for (int r = 0; r < REPS; r++) {
+            for (int i = 0; i < STRINGS; i++) {
+                const char* p = strings[c][i];
+                while (*(p = apm_bench_scan_reference(p))) {
+                    p++;
+                }
+                sink += (size_t)p;
+            }
+        }
+        double reference = (apm_bench_now() - start) / REPS / STRINGS;
+
+        start = apm_bench_now();
+        for (int r = 0; r < REPS; r++) {
+            for (int i = 0; i < STRINGS; i++) {
+                const char* p = strings[c][i];
+                while (*(p = apm_escape_scan(p))) {
+                    p++;
+                }
+                sink += (size_t)p;
+            }
+        }
+        double kernel = (apm_bench_now() - start) / REPS / STRINGS;
+
+        apm_ndjson_t writer;
+        apm_ndjson_init(&writer, 1 << 20);
+        start = apm_bench_now();
+        for (int r = 0; r < REPS; r++) {
+            for (int i = 0; i < STRINGS; i++) {
+                apm_ndjson_string(&writer, NULL, 0, strings[c][i]);
+            }
+            writer.len = 0;
+            writer.comma = false;
+        }
+        double ndjson = (apm_bench_now() - start) / REPS / STRINGS;
+        apm_ndjson_free(&writer);
+
+        //! o cJSON inclui a alocação do CreateString e do Print
+        start = apm_bench_now();
+        for (int r = 0; r < REPS; r++) {
+            for (int i = 0; i < STRINGS; i++) {
+                cJSON* json = cJSON_CreateString(strings[c][i]);
+                char* out = cJSON_PrintUnformatted(json);
+                sink += out[1];
+                free(out);
+                cJSON_Delete(json);
+            }
+        }
+        double cjson = (apm_bench_now() - start) / REPS / STRINGS;
+
+        printf("| %-17s | %10.0f | %10.1f | %6.1f | %6.1f | %5.0f |\n", categories[c], (double)total_len[c] / STRINGS,
+               reference * 1e9, kernel * 1e9, ndjson * 1e9, cjson * 1e9);
+    }
+
+    for (int c = 0; c < CATEGORIES; c++) {
+        for (int i = 0; i < STRINGS; i++) {
+            free(strings[c][i]);
+        }
+    }
+    printf("\n(sink %zu)\n", sink);
+    return 0;
+}
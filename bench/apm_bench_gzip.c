@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_gzip.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
+
+//! cpu gasta para comprimir, um request por transação, um lote de payloads com ids aleatórios, queries e urls
+//! variadas e alguns erros: deflateInit2/deflateEnd por envio no nível 9 (o compressor antigo) contra o apm_gzip em
+//! cada nível
+
+#define TRANSACTIONS 40
+#define REPS 150
+
+//! tamanho do buffer de upload da libcurl, por onde o apm_gzip é drenado
+#define UPLOAD_BUFFER_SIZE 65536
+
+typedef struct {
+    apm_payload_t payloads[TRANSACTIONS];
+    size_t len;
+} apm_bench_corpus_t;
+
+static apm_config_t config = { .bypass = 0, .name = "orders-api", .environment = "production", .url = "http://localhost", .token = "" };
+
+static const char* tables[] = { "orders", "customers", "order_items", "payments", "shipments", "products", "inventory" };
+static const char* hosts[] = { "billing.internal", "stock.internal", "auth.internal", "search.internal" };
+
+static double apm_bench_cpu(void);
+static void apm_bench_build_corpus(apm_bench_corpus_t* corpus);
+static size_t apm_bench_deflate_per_request(const apm_payload_t* payload);
+static size_t apm_bench_gzip(const apm_payload_t* payload);
+
+
+static double apm_bench_cpu(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void apm_bench_build_corpus(apm_bench_corpus_t* corpus)
+{
+    char buffer[256];
+
+    srand(42);
+    corpus->len = 0;
+    for (int t = 0; t < TRANSACTIONS; t++) {
+        snprintf(buffer, sizeof(buffer), "%s /api/v1/%s/{id}", t % 3 ? "GET" : "POST", tables[t % 7]);
+        apm_transaction_t* transaction = apm_begin_transaction(buffer, "request", NULL, NULL);
+
+        int spans = 5 + rand() % 40;
+        for (int i = 0; i < spans; i++) {
+            apm_span_t* span = NULL;
+            if (i % 3 == 0) {
+                span = apm_begin_span(transaction, NULL, "HTTP GET", "external", "http");
+                snprintf(buffer, sizeof(buffer), "https://%s/v2/items/%d?expand=details&locale=pt-BR", hosts[rand() % 4], rand() % 100000);
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_HTTP_URL, buffer);
+                apm_add_int_attr_to_span(transaction, span, APM_ATTR_HTTP_STATUS_CODE, rand() % 10 ? 200 : 503);
+            }
+            else {
+                const char* table = tables[rand() % 7];
+                snprintf(buffer, sizeof(buffer), "SELECT %s", table);
+                span = apm_begin_span(transaction, NULL, buffer, "db", "postgresql");
+                snprintf(buffer, sizeof(buffer), "SELECT id, status, total, updated_at FROM %s WHERE customer_id = %d "
+                         "AND status IN ('open','paid') ORDER BY updated_at DESC LIMIT %d", table, rand() % 1000000, 10 + rand() % 90);
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_DB_STATEMENT, buffer);
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_DB_TYPE, "sql");
+                apm_add_str_attr_to_span(transaction, span, APM_ATTR_DESTINATION_SERVICE_RESOURCE, "postgresql");
+                apm_add_int_attr_to_span(transaction, span, APM_ATTR_DESTINATION_PORT, 5432);
+            }
+            span->captured = true;
+            apm_end_span(transaction, span, SUCCESS);
+        }
+
+        if (t % 8 == 0) {
+            apm_catch_transaction_error(transaction, NULL, "SIGSEGV", "SIGSEGV", "Segmentation fault", NULL, 0, false);
+        }
+
+        apm_create_payload(transaction, &corpus->payloads[t]);
+        corpus->len += corpus->payloads[t].len;
+        apm_free_transaction(transaction);
+    }
+}
+
+static size_t apm_bench_deflate_per_request(const apm_payload_t* payload)
+{
+    //! o compressor antigo: stream novo por envio, saída inteira em um buffer de compressBound
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY);
+
+    uLong bound = deflateBound(&stream, payload->len);
+    Bytef* out = malloc(bound);
+    stream.next_out = out;
+    stream.avail_out = bound;
+    for (int i = 0; i < payload->count; i++) {
+        stream.next_in = payload->chunks[i].iov_base;
+        stream.avail_in = payload->chunks[i].iov_len;
+        deflate(&stream, i == payload->count - 1 ? Z_FINISH : Z_NO_FLUSH);
+    }
+
+    size_t len = stream.total_out;
+    deflateEnd(&stream);
+    free(out);
+    return len;
+}
+
+static size_t apm_bench_gzip(const apm_payload_t* payload)
+{
+    static char buffer[UPLOAD_BUFFER_SIZE];
+    apm_gzip_t gzip;
+    size_t len = 0;
+    size_t n = 0;
+
+    apm_gzip_begin(&gzip, payload->chunks, payload->count);
+    while ((n = apm_gzip_read(&gzip, buffer, sizeof(buffer))) > 0) {
+        len += n;
+    }
+    return len;
+}
+
+int main(void)
+{
+    static apm_bench_corpus_t corpus;
+    size_t compressed = 0;
+
+    apm_init(&config);
+    apm_bench_build_corpus(&corpus);
+    printf("lote: %zu bytes em %d payloads\n\n", corpus.len, TRANSACTIONS);
+
+    printf("| compressor                         | CPU ms/MB | razão |\n");
+    printf("|------------------------------------|-----------|-------|\n");
+
+    double start = apm_bench_cpu();
+    for (int r = 0; r < REPS; r++) {
+        compressed = 0;
+        for (int i = 0; i < TRANSACTIONS; i++) {
+            compressed += apm_bench_deflate_per_request(&corpus.payloads[i]);
+        }
+    }
+    double elapsed = (apm_bench_cpu() - start) / REPS;
+    printf("| init/end por envio, nível 9        | %9.1f | %5.2f |\n", elapsed * 1e3 / (corpus.len / 1048576.0), (double)corpus.len / compressed);
+
+    for (int level = Z_BEST_SPEED; level <= Z_BEST_COMPRESSION; level++) {
+        apm_gzip_set_level(level);
+        start = apm_bench_cpu();
+        for (int r = 0; r < REPS; r++) {
+            compressed = 0;
+            for (int i = 0; i < TRANSACTIONS; i++) {
+                compressed += apm_bench_gzip(&corpus.payloads[i]);
+            }
+        }
+        elapsed = (apm_bench_cpu() - start) / REPS;
+        printf("| apm_gzip, nível %d                  | %9.1f | %5.2f |\n", level, elapsed * 1e3 / (corpus.len / 1048576.0), (double)corpus.len / compressed);
+    }
+
+    for (int i = 0; i < TRANSACTIONS; i++) {
+        apm_payload_free(&corpus.payloads[i]);
+    }
+    apm_gzip_clear();
+    apm_destroy();
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_instrument.h>
+
+//! custo da instrumentação com o APM desligado, no modo escolhido por APM_INSTRUMENT_MODE na compilação
+
+#define ITERATIONS 10000000
+
+static apm_config_t config = { .bypass = 1, .name = "bench", .environment = "bench", .url = "http://localhost", .token = "" };
+
+static double apm_bench_now(void);
+
+
+static double apm_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char statement[128] = "";
+    long sink = 0;
+
+    apm_init(&config);
+
+    double start = apm_bench_now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        APM_SPAN_BEGIN("query", "db", "sql");
+        //! o valor formatado é o que a instrumentação costuma pagar mesmo com o APM desligado
+        if (APM_ENABLED()) {
+            snprintf(statement, sizeof(statement), "select * from t where id = %d", i);
+        }
+        APM_CONTEXT_STR(statement, "db", "statement", NULL);
+        APM_SPAN_END(SUCCESS);
+        sink += i;
+    }
+    double elapsed = apm_bench_now() - start;
+
+    printf("APM_INSTRUMENT_MODE %d: %.2f ns por span (sink %ld)\n", APM_INSTRUMENT_MODE, elapsed * 1e9 / ITERATIONS, sink);
+
+    apm_destroy();
+    return 0;
+}
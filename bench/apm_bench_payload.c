@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
+
+//! tempo de apm_create_payload para uma transação com N spans, cada um com 4 atributos
+
+static apm_config_t config = { .bypass = 0, .name = "bench", .environment = "bench", .url = "http://localhost", .token = "" };
+
+static double apm_bench_now(void);
+static void apm_bench_payload(int spans);
+
+
+static double apm_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void apm_bench_payload(int spans)
+{
+    apm_transaction_t* transaction = apm_begin_transaction("GET /api/orders", "request", NULL, NULL);
+    for (int i = 0; i < spans; i++) {
+        apm_span_t* span = apm_begin_span(transaction, NULL, "SELECT orders", "db", "postgresql");
+        apm_add_str_attr_to_span(transaction, span, APM_ATTR_DB_STATEMENT, "SELECT id, total FROM orders WHERE customer_id = $1");
+        apm_add_str_attr_to_span(transaction, span, APM_ATTR_DB_TYPE, "sql");
+        apm_add_str_attr_to_span(transaction, span, APM_ATTR_DESTINATION_SERVICE_RESOURCE, "postgresql");
+        apm_add_int_attr_to_span(transaction, span, APM_ATTR_DESTINATION_PORT, 5432);
+        //! sem compressão: os N spans chegam ao payload
+        span->captured = true;
+        apm_end_span(transaction, span, SUCCESS);
+    }
+
+    int reps = spans >= 10000 ? 5 : (spans >= 100 ? 500 : 5000);
+    size_t bytes = 0;
+
+    double start = apm_bench_now();
+    for (int r = 0; r < reps; r++) {
+        apm_payload_t payload;
+        apm_create_payload(transaction, &payload);
+        bytes = payload.len;
+        apm_payload_free(&payload);
+    }
+    double elapsed = (apm_bench_now() - start) / reps;
+
+    printf("| %6d | %8zu | %10.1f | %6.0f |\n", spans, bytes, elapsed * 1e6, elapsed * 1e9 / spans);
+    apm_free_transaction(transaction);
+}
+
+int main(int argc, char** argv)
+{
+    apm_init(&config);
+
+    printf("| spans  | bytes    | us/payload | ns/span |\n");
+    printf("|--------|----------|------------|---------|\n");
+    if (argc > 1) {
+        apm_bench_payload(atoi(argv[1]));
+    }
+    else {
+        apm_bench_payload(10);
+        apm_bench_payload(100);
+        apm_bench_payload(10000);
+    }
+
+    apm_destroy();
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef APM_ARENA_H
+#define APM_ARENA_H
+
+#include <stddef.h>
+
+//! tamanho padrão de cada bloco da arena. uma transação típica (alguns spans com contexto) cabe em um único bloco.
+#define APM_ARENA_CHUNK_SIZE 4096
+
+//! quantidade máxima de blocos guardados para reuso. em regime, uma transação nova não faz nenhum malloc.
+#define APM_ARENA_CACHE_MAX 64
+
+typedef struct apm_arena_chunk apm_arena_chunk_t;
+
+/**
+ * @brief Arena de alocação (bump allocator) de uma transação.
+ *
+ * Todos os spans, erros, ids e strings de uma transação são alocados daqui. Nada é liberado individualmente: a
+ * arena inteira é devolvida de uma vez por apm_arena_free, depois que a transação foi enviada ou descartada.
+ *
+ * @warning Não é thread-safe. Uma transação é manipulada por uma thread de cada vez.
+ */
+typedef struct {
+    apm_arena_chunk_t* chunk; //!< bloco corrente (os anteriores ficam encadeados a partir dele)
+    size_t allocs;            //!< quantidade de alocações servidas pela arena
+    size_t chunks;            //!< quantidade de blocos pedidos ao malloc
+} apm_arena_t;
+
+apm_arena_t* apm_arena_new(void);
+void apm_arena_free(apm_arena_t* arena);
+void apm_arena_clear_cache(void);
+void* apm_arena_alloc(apm_arena_t* arena, size_t size);
+char* apm_arena_strdup(apm_arena_t* arena, const char* str);
+char* apm_arena_dup_value_or_default(apm_arena_t* arena, const char* value, const char* def);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef APM_ATTR_H
+#define APM_ATTR_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+//! capacidade inicial do vetor de atributos de um span. cobre os campos que o stub do curl preenche.
+#define APM_SPAN_ATTRS_INITIAL 12
+
+//! capacidade inicial do vetor de campos livres de um span e profundidade máxima do caminho de cada um
+#define APM_SPAN_FIELDS_INITIAL 4
+#define APM_CONTEXT_PATH_MAX 8
+
+/**
+ * @brief Chaves conhecidas do contexto de um span (span.context do intake do Elastic APM).
+ *
+ * Cada chave já sabe o seu caminho no json e o tipo do valor, então adicionar um atributo não precisa montar nem
+ * percorrer um mapa. Campos fora desta lista continuam disponíveis via apm_add_str_to_span_context.
+ */
+typedef enum {
+    APM_ATTR_HTTP_URL,
+    APM_ATTR_HTTP_METHOD,
+    APM_ATTR_HTTP_STATUS_CODE,
+    APM_ATTR_SERVICE_TARGET_NAME,
+    APM_ATTR_SERVICE_TARGET_TYPE,
+    APM_ATTR_DESTINATION_SERVICE_NAME,
+    APM_ATTR_DESTINATION_SERVICE_RESOURCE,
+    APM_ATTR_DESTINATION_SERVICE_TYPE,
+    APM_ATTR_DESTINATION_ADDRESS,
+    APM_ATTR_DESTINATION_PORT,
+    APM_ATTR_DB_INSTANCE,
+    APM_ATTR_DB_STATEMENT,
+    APM_ATTR_DB_TYPE,
+    APM_ATTR_DB_USER,
+    APM_ATTR_MESSAGE_QUEUE_NAME,
+    APM_ATTR_KEYS
+} apm_attr_key_t;
+
+typedef enum {
+    APM_ATTR_STR,
+    APM_ATTR_INT,
+    APM_ATTR_NUMBER  //!< double; só nos campos livres (apm_add_int_to_span_context recebe um double*)
+} apm_attr_type_t;
+
+typedef struct {
+    uint16_t key;
+    uint16_t type;
+    union {
+        const char* str;
+        int64_t number;
+    } value;
+} apm_attr_t;
+
+/**
+ * @brief Campo livre do contexto de um span, com o caminho informado em apm_add_str_to_span_context.
+ *
+ * O caminho e o valor ficam na arena da transação; as chaves vão para a tabela de strings internadas. O json é
+ * escrito direto a partir dos campos, sem mapa intermediário.
+ */
+typedef struct {
+    const char** path;
+    int depth;
+    apm_attr_type_t type;  //!< APM_ATTR_STR ou APM_ATTR_NUMBER
+    union {
+        const char* str;
+        double number;
+    } value;
+} apm_field_t;
+
+//! usa as tags das estruturas porque apm.h inclui este arquivo antes de declarar os typedefs
+struct apm_transaction;
+struct apm_span;
+struct apm_ndjson;
+
+void apm_set_span_attr(struct apm_transaction* transaction, struct apm_span* span, apm_attr_key_t key, apm_attr_type_t type, const char* str, int64_t number);
+
+/**
+ * @brief Grava um campo livre no contexto do span. As chaves do caminho vêm em args, terminadas por NULL.
+ *
+ * O mesmo caminho gravado de novo substitui o valor anterior.
+ */
+void apm_set_span_field(struct apm_transaction* transaction, struct apm_span* span, apm_attr_type_t type, const void* value, va_list args);
+
+/**
+ * @brief Escreve o campo context do span (atributos tipados e campos livres num único objeto), se houver algum.
+ */
+void apm_span_context_to_ndjson(const struct apm_span* span, struct apm_ndjson* writer);
+
+#endif
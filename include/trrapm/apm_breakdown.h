@@ -0,0 +1,36 @@
+#ifndef APM_BREAKDOWN_H
+#define APM_BREAKDOWN_H
+
+#include <stdint.h>
+
+//! quantidade de posições da tabela. precisa ser potência de 2.
+#define APM_BREAKDOWN_SLOTS 1024
+
+//! limite de combinações por intervalo; o elastic também corta as métricas de breakdown em mil por intervalo
+#define APM_BREAKDOWN_MAX_ENTRIES 1000
+
+struct apm_transaction;
+struct apm_ndjson;
+
+/**
+ * @brief Acumula o tempo próprio (self time) dos spans de uma transação que terminou.
+ *
+ * O tempo próprio de um span é a sua duração menos o trecho coberto pelos filhos. A transação entra como um span
+ * do tipo "app". Os valores são agregados por (transaction.type, transaction.name, span.type, span.subtype) e
+ * ponderados por 1 / sample_rate, de forma que as transações descartadas pela amostragem também sejam
+ * contabilizadas.
+ *
+ * Deve ser chamada antes da decisão de envio, porque as transações descartadas pelas restrições também contam.
+ */
+void apm_record_breakdown(struct apm_transaction* transaction);
+
+/**
+ * @brief Escreve no payload um metricset por combinação acumulada desde a última chamada e zera a tabela.
+ *
+ * @param timestamp instante do intervalo, em microssegundos.
+ * @param writer payload ndjson; NULL apenas descarta o que foi acumulado.
+ */
+void apm_dump_breakdown(uint64_t timestamp, struct apm_ndjson* writer);
+void apm_breakdown_clear(void);
+
+#endif
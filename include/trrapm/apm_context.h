@@ -0,0 +1,56 @@
+#ifndef APM_CONTEXT_H
+#define APM_CONTEXT_H
+
+#include <stdbool.h>
+
+struct apm_transaction;
+struct apm_span;
+
+//! pilha de spans da api implícita (apm_begin_capture_span / apm_end_capture_span) de uma thread
+typedef struct {
+    struct apm_span** spans;
+    int depth;
+    int size;
+} apm_span_stack_t;
+
+/**
+ * @brief Contexto de rastreamento capturado para ser continuado em um callback, fila ou event loop.
+ *
+ * É um valor: pode ser copiado para dentro da estrutura do trabalho assíncrono. Enquanto não for liberado, segura
+ * uma referência à transação, que só é enviada depois que todos os contextos capturados forem liberados.
+ */
+typedef struct {
+    struct apm_transaction* transaction;  //!< NULL se não havia transação corrente na captura
+    struct apm_span* span;                //!< span ativo na captura; os spans da continuação ficam abaixo dele
+    const char* trace_id;
+    bool in_span;                         //!< havia span na pilha (span NULL com in_span é um span descartado)
+
+    //! estado da thread guardado por apm_context_restore e devolvido por apm_context_release
+    bool restored;
+    struct apm_transaction* saved_transaction;
+    struct apm_transaction* saved_restored;
+    apm_span_stack_t saved_stack;
+} apm_context_t;
+
+/**
+ * @brief Captura a transação e o span ativos da thread.
+ */
+apm_context_t apm_context_capture(void);
+
+/**
+ * @brief Torna o contexto o corrente da thread que chamou, até apm_context_release.
+ *
+ * Os spans abertos pela api implícita a partir daqui são filhos do span capturado. A continuação pode rodar em
+ * paralelo com a thread que capturou: enquanto houver contexto capturado, as alterações na transação são
+ * serializadas.
+ */
+void apm_context_restore(apm_context_t* context);
+
+/**
+ * @brief Devolve o estado anterior da thread, se o contexto foi restaurado, e libera a referência à transação.
+ *
+ * Todo contexto capturado precisa ser liberado exatamente uma vez, mesmo que nunca tenha sido restaurado.
+ */
+void apm_context_release(apm_context_t* context);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef APM_ESCAPE_H
+#define APM_ESCAPE_H
+
+/**
+ * @brief Procura o primeiro byte de s que o json exige escapar: aspas, barra invertida ou caractere de controle.
+ *
+ * O '\0' final também é um caractere de controle, então o retorno nunca passa do fim da string; quem chama compara
+ * com '\0' para saber se chegou ao fim. Tudo entre s e o retorno pode ser copiado de uma vez, sem escape.
+ *
+ * Em x86 a varredura usa AVX2 (32 bytes por iteração) ou SSE2 (16 bytes), escolhidos em tempo de execução na
+ * primeira chamada; nas outras arquiteturas cai no laço byte a byte. Serve a qualquer serializador de json do agente
+ * (o escritor ndjson e o print_string_ptr do cJSON).
+ */
+const char* apm_escape_scan(const char* s);
+
+#endif
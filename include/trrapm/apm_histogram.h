@@ -0,0 +1,38 @@
+#ifndef APM_HISTOGRAM_H
+#define APM_HISTOGRAM_H
+
+#include <stdint.h>
+
+//! bits de precisão de cada potência de 2: 32 faixas por oitava, erro relativo máximo de ~3%
+#define APM_HISTOGRAM_SUB_BITS 5
+#define APM_HISTOGRAM_SUB_BUCKETS (1 << APM_HISTOGRAM_SUB_BITS)
+
+//! durações em microssegundos até 2^32 (pouco mais de 71 minutos); acima disso tudo cai na última faixa
+#define APM_HISTOGRAM_MAX_BITS 32
+#define APM_HISTOGRAM_BUCKETS ((APM_HISTOGRAM_MAX_BITS - APM_HISTOGRAM_SUB_BITS + 1) * APM_HISTOGRAM_SUB_BUCKETS)
+
+//! posições da tabela de séries de cada thread. precisa ser potência de 2.
+#define APM_HISTOGRAM_SLOTS 256
+#define APM_HISTOGRAM_MAX_SERIES (APM_HISTOGRAM_SLOTS / 2)
+
+struct apm_transaction;
+struct apm_ndjson;
+
+/**
+ * @brief Registra a duração de uma transação no histograma de (name, type, outcome).
+ *
+ * Cada thread grava no seu próprio shard, sem lock: só a dona cria séries, e os contadores são incrementos
+ * atômicos sem disputa. A thread de métricas zera e soma os shards a cada intervalo.
+ */
+void apm_record_histogram(struct apm_transaction* transaction);
+
+/**
+ * @brief Junta os shards de todas as threads e escreve no payload um metricset do tipo histogram por série.
+ *
+ * @param timestamp instante do intervalo, em microssegundos.
+ * @param writer payload ndjson; NULL apenas descarta o que foi acumulado.
+ */
+void apm_dump_histograms(uint64_t timestamp, struct apm_ndjson* writer);
+void apm_histogram_clear(void);
+
+#endif
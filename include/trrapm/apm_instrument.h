@@ -0,0 +1,62 @@
+#ifndef APM_INSTRUMENT_H
+#define APM_INSTRUMENT_H
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_attr.h>
+
+//! modos da instrumentação, escolhidos em tempo de compilação por quem inclui este header:
+//!   APM_INSTRUMENT_OFF     as macros somem; nenhum argumento é avaliado e nenhum código é gerado
+//!   APM_INSTRUMENT_RUNTIME (padrão) um teste em apm_enabled, marcado como improvável, antes de avaliar os argumentos
+//!   APM_INSTRUMENT_FULL    chamada direta, como nas funções públicas (que continuam testando o bypass)
+#define APM_INSTRUMENT_OFF 0
+#define APM_INSTRUMENT_RUNTIME 1
+#define APM_INSTRUMENT_FULL 2
+
+#ifndef APM_INSTRUMENT_MODE
+#define APM_INSTRUMENT_MODE APM_INSTRUMENT_RUNTIME
+#endif
+
+//! diferente de 0 entre apm_init (sem bypass) e apm_destroy
+extern int apm_enabled;
+
+#if APM_INSTRUMENT_MODE == APM_INSTRUMENT_OFF
+#define APM_ENABLED() 0
+#define APM_CALL(call) ((void)0)
+#elif APM_INSTRUMENT_MODE == APM_INSTRUMENT_FULL
+#define APM_ENABLED() 1
+#define APM_CALL(call) do { call; } while (0)
+#else
+#define APM_ENABLED() __builtin_expect(apm_enabled != 0, 0)
+#define APM_CALL(call) do { if (APM_ENABLED()) { call; } } while (0)
+#endif
+
+//! APM_ENABLED() também serve para proteger a montagem de valores caros (snprintf de uma query, por exemplo):
+//!   if (APM_ENABLED()) { snprintf(buffer, sizeof(buffer), ...); APM_CONTEXT_STR(buffer, "db", "statement", NULL); }
+
+#define APM_TRANSACTION_BEGIN(name, type, trace_id, parent_id) \
+    APM_CALL(apm_begin_capture_transaction((name), (type), (trace_id), (parent_id)))
+#define APM_TRANSACTION_CONTINUE(name, type, traceparent, tracestate) \
+    APM_CALL(apm_continue_capture_transaction((name), (type), (traceparent), (tracestate)))
+#define APM_TRANSACTION_END(outcome, result) \
+    APM_CALL(apm_end_capture_transaction((outcome), (result)))
+
+#define APM_SPAN_BEGIN(name, type, subtype) \
+    APM_CALL(apm_begin_capture_span((name), (type), (subtype)))
+#define APM_EXIT_SPAN_BEGIN(name, type, subtype, destination) \
+    APM_CALL(apm_begin_capture_exit_span((name), (type), (subtype), (destination)))
+#define APM_SPAN_END(outcome) \
+    APM_CALL(apm_end_capture_span((outcome)))
+
+#define APM_CONTEXT_STR(value, ...) \
+    APM_CALL(apm_add_str_to_span_context((value), __VA_ARGS__))
+#define APM_CONTEXT_INT(value, ...) \
+    APM_CALL(apm_add_int_to_span_context((value), __VA_ARGS__))
+#define APM_SPAN_ATTR_STR(key, value) \
+    APM_CALL(apm_add_str_attr_to_span_context((key), (value)))
+#define APM_SPAN_ATTR_INT(key, value) \
+    APM_CALL(apm_add_int_attr_to_span_context((key), (value)))
+
+#define APM_ERROR(culprit, signal, message, handled) \
+    APM_CALL(apm_catch_error((culprit), (signal), (message), NULL, 0, (handled)))
+
+#endif
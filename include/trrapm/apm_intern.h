@@ -0,0 +1,27 @@
+#ifndef APM_INTERN_H
+#define APM_INTERN_H
+
+#include <trrapm/apm_arena.h>
+
+//! quantidade de posições da tabela. precisa ser potência de 2.
+#define APM_INTERN_SLOTS 1024
+
+//! a tabela nunca é esvaziada, então só aceitamos até metade das posições e strings curtas. nomes com alta
+//! cardinalidade (urls, por exemplo) acabam copiados para a arena da transação.
+#define APM_INTERN_MAX_ENTRIES (APM_INTERN_SLOTS / 2)
+#define APM_INTERN_MAX_LEN 128
+
+/**
+ * @brief Tabela global de strings imutáveis compartilhadas (nomes, tipos, subtipos e outcomes de spans).
+ *
+ * A busca não usa lock: cada posição é lida com load-acquire e preenchida uma única vez com compare-and-swap. As
+ * entradas nunca são removidas nem alteradas, portanto o ponteiro devolvido vale até o fim do processo: transações
+ * ainda abertas em outras threads (ou presas em um contexto capturado) continuam apontando para elas mesmo depois
+ * de apm_destroy. a tabela é limitada a APM_INTERN_MAX_ENTRIES strings.
+ *
+ * @return ponteiro compartilhado, ou NULL se a string não puder ser internada (tabela cheia ou string longa).
+ */
+const char* apm_intern(const char* str);
+const char* apm_intern_value_or_default(apm_arena_t* arena, const char* value, const char* def);
+
+#endif
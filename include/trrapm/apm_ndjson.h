@@ -0,0 +1,64 @@
+#ifndef APM_NDJSON_H
+#define APM_NDJSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! capacidade inicial do buffer. cobre o metadata e uma transação com alguns spans sem realocar.
+#define APM_NDJSON_INITIAL_SIZE 4096
+
+//! chave constante já escapada, com aspas e dois pontos: expande para os dois argumentos (texto, tamanho)
+#define APM_NDJSON_KEY(name) "\"" name "\":", sizeof("\"" name "\":") - 1
+
+/**
+ * @brief Escritor de payload ndjson: um buffer que só cresce, sem árvore intermediária.
+ *
+ * Cada evento é escrito campo a campo, na ordem, direto no buffer. O buffer dobra de tamanho quando enche, então
+ * montar um payload com N eventos custa O(N) e não O(N²) como o realloc + strcat por evento.
+ *
+ * As funções de valor recebem a chave já escapada (APM_NDJSON_KEY) ou NULL, para elementos de array e para o
+ * valor de uma chave escrita por apm_ndjson_key. A vírgula entre campos é colocada pelo próprio escritor.
+ *
+ * Uma falha de alocação marca o escritor como falho; as escritas seguintes são ignoradas e apm_ndjson_detach
+ * devolve NULL, para que um payload truncado nunca seja enviado.
+ */
+typedef struct apm_ndjson {
+    char* data;
+    size_t len;
+    size_t size;
+    bool comma;  //!< o próximo campo do objeto ou array corrente precisa de vírgula
+    bool failed;
+} apm_ndjson_t;
+
+int apm_ndjson_init(apm_ndjson_t* writer, size_t size);
+void apm_ndjson_free(apm_ndjson_t* writer);
+
+/**
+ * @brief Devolve o payload terminado em '\0' e deixa o escritor vazio. Quem chama libera com free.
+ */
+char* apm_ndjson_detach(apm_ndjson_t* writer);
+
+//! texto já serializado, copiado como está (uma linha de metadata pronta, por exemplo)
+void apm_ndjson_raw(apm_ndjson_t* writer, const char* data, size_t len);
+
+//! abre e fecha uma linha do payload: {"<tipo>":{ ... }}\n
+void apm_ndjson_begin_event(apm_ndjson_t* writer, const char* key, size_t key_len);
+void apm_ndjson_end_event(apm_ndjson_t* writer);
+
+void apm_ndjson_begin_object(apm_ndjson_t* writer, const char* key, size_t key_len);
+void apm_ndjson_end_object(apm_ndjson_t* writer);
+void apm_ndjson_begin_array(apm_ndjson_t* writer, const char* key, size_t key_len);
+void apm_ndjson_end_array(apm_ndjson_t* writer);
+
+//! chave que só é conhecida em tempo de execução; é escapada aqui e o valor segue com chave NULL
+void apm_ndjson_key(apm_ndjson_t* writer, const char* name);
+
+//! string NULL não escreve o campo, como o cJSON_AddStringToObject fazia
+void apm_ndjson_string(apm_ndjson_t* writer, const char* key, size_t key_len, const char* value);
+void apm_ndjson_number(apm_ndjson_t* writer, const char* key, size_t key_len, double value);
+void apm_ndjson_uint64(apm_ndjson_t* writer, const char* key, size_t key_len, uint64_t value);
+void apm_ndjson_int64(apm_ndjson_t* writer, const char* key, size_t key_len, int64_t value);
+void apm_ndjson_bool(apm_ndjson_t* writer, const char* key, size_t key_len, bool value);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef APM_PAYLOAD_H
+#define APM_PAYLOAD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct apm_ndjson;
+
+/**
+ * @brief Linha de metadata já serializada (com o '\n'), imutável e com contagem de referências.
+ *
+ * A linha é renderizada uma vez e compartilhada por todos os payloads, da thread de envio e da de métricas,
+ * sem cópia. Ela só é renderizada de novo quando o pid muda (depois de um fork); quem ainda segura a versão
+ * antiga continua usando-a até chamar apm_metadata_release.
+ */
+typedef struct apm_metadata_line {
+    int refs;
+    pid_t pid;  //!< processo para o qual a linha foi renderizada
+    size_t len;
+    char data[];
+} apm_metadata_line_t;
+
+/**
+ * @brief Devolve a linha de metadata corrente com uma referência a mais, renderizando-a se preciso.
+ *
+ * @return NULL se a metadata não pôde ser montada. Quem recebe uma linha libera com apm_metadata_release.
+ */
+apm_metadata_line_t* apm_metadata_acquire(void);
+void apm_metadata_release(apm_metadata_line_t* line);
+
+//! descarta a linha corrente e a metadata guardada. chamado em apm_destroy, depois que as threads terminaram.
+void apm_metadata_clear(void);
+
+//! metadata + eventos; sobra espaço para quem quiser encadear mais trechos
+#define APM_PAYLOAD_MAX_CHUNKS 4
+
+/**
+ * @brief Corpo de uma requisição como uma cadeia de trechos (iovec), entregue ao compressor e à libcurl sem
+ * concatenação.
+ *
+ * O primeiro trecho é a linha de metadata compartilhada; os seguintes são os eventos serializados. O payload
+ * segura uma referência da metadata e é dono dos buffers de eventos; apm_payload_free libera tudo.
+ */
+typedef struct apm_payload {
+    struct iovec chunks[APM_PAYLOAD_MAX_CHUNKS];
+    int count;
+    size_t len;  //!< soma dos trechos
+    apm_metadata_line_t* metadata;  //!< dona do primeiro trecho, quando presente
+} apm_payload_t;
+
+/**
+ * @brief Inicia o payload com a linha de metadata corrente.
+ *
+ * @return 0 em caso de sucesso, -1 se a metadata não está disponível (o payload fica vazio, mas pode ser liberado).
+ */
+int apm_payload_init(apm_payload_t* payload);
+
+/**
+ * @brief Encadeia os eventos do escritor como um novo trecho; o payload passa a ser dono do buffer.
+ *
+ * @return 0 em caso de sucesso, -1 se o escritor falhou ou não há espaço na cadeia; o escritor fica vazio nos dois
+ * casos.
+ */
+int apm_payload_add_events(apm_payload_t* payload, struct apm_ndjson* writer);
+
+void apm_payload_free(apm_payload_t* payload);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef APM_SAMPLER_H
+#define APM_SAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//! quantidade de nomes de transação acompanhados. precisa ser potência de 2.
+#define APM_SAMPLER_SLOTS 256
+
+//! nomes além de metade da tabela dividem um único orçamento, para a sondagem não ficar longa
+#define APM_SAMPLER_MAX_ENTRIES (APM_SAMPLER_SLOTS / 2)
+
+//! nomes maiores são truncados na comparação; duas transações que só diferem depois disso dividem o orçamento
+#define APM_SAMPLER_MAX_NAME 64
+
+//! intervalo em que a taxa efetiva de cada nome é recalculada
+#define APM_SAMPLER_INTERVAL_NS 1000000000ULL
+
+/**
+ * @brief Amostragem adaptativa por nome de transação.
+ *
+ * Cada nome tem o seu próprio orçamento de max_per_second transações por segundo. A cada intervalo a taxa do nome é
+ * recalculada a partir do volume observado (com média móvel, para não oscilar) e, entre os recálculos, um token
+ * bucket com capacidade de um segundo de orçamento detecta os picos: quando ele esvazia, a taxa do nome é reduzida
+ * na hora para o volume já visto no intervalo. A transação é sempre sorteada contra a taxa que é informada, então
+ * 1/sample_rate é um peso correto para extrapolar o volume. Como os orçamentos são independentes, um endpoint raro
+ * nunca perde espaço para um endpoint muito frequente: ele continua sendo amostrado com taxa 1.
+ *
+ * @param name nome da transação.
+ * @param max_per_second quantidade de transações amostradas por segundo desejada para o nome.
+ * @param rate recebe a taxa efetiva (arredondada para 4 casas), que deve ir no sample_rate da transação.
+ * @return true se a transação deve ser amostrada.
+ */
+bool apm_sampler_sample(const char* name, double max_per_second, double* rate);
+double apm_round_sample_rate(double rate);
+void apm_sampler_clear(void);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef APM_TRACEPARENT_H
+#define APM_TRACEPARENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define APM_TRACEPARENT_TRACE_ID_LEN 32
+#define APM_TRACEPARENT_PARENT_ID_LEN 16
+//! "00-" + trace id + "-" + parent id + "-" + flags
+#define APM_TRACEPARENT_LEN (3 + APM_TRACEPARENT_TRACE_ID_LEN + 1 + APM_TRACEPARENT_PARENT_ID_LEN + 3)
+//! "es=s:" + até 17 dígitos significativos
+#define APM_TRACESTATE_LEN 32
+
+#define APM_TRACE_FLAG_SAMPLED 0x01
+
+/**
+ * @brief Contexto de trace recebido pelos headers W3C traceparent e tracestate.
+ *
+ * Os ids ficam em hexadecimal minúsculo, no mesmo formato usado pelas transações e spans, em buffers de tamanho fixo.
+ * Nem o parser nem o formatador alocam memória.
+ */
+typedef struct {
+    char trace_id[APM_TRACEPARENT_TRACE_ID_LEN + 1];
+    char parent_id[APM_TRACEPARENT_PARENT_ID_LEN + 1];
+    uint8_t flags;      //!< APM_TRACE_FLAG_SAMPLED
+    double sample_rate; //!< entrada es=s: do tracestate; negativo quando ausente
+} apm_trace_context_t;
+
+int apm_parse_traceparent(const char* header, apm_trace_context_t* context);
+int apm_parse_tracestate(const char* header, apm_trace_context_t* context);
+int apm_format_traceparent(const char* trace_id, const char* parent_id, uint8_t flags, char* buffer, size_t size);
+int apm_format_tracestate(double sample_rate, char* buffer, size_t size);
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,11 +10,20 @@
 #include <trrlog1/trrlog.h>
 #include <trrutil/ndtlist.h>
 #include <trrapm/apm.h>
+#include <trrapm/apm_attr.h>
+#include <trrapm/apm_context.h>
+#include <trrapm/apm_gzip.h>
+#include <trrapm/apm_instrument.h>
+#include <trrapm/apm_payload.h>
+#include <trrapm/apm_traceparent.h>
 #include <trrapm/apm_internal.h>
 
 #define APM_FACILITY_LABEL "APM"
 int apm_facility = -1;
 
+//! lido pelas macros de apm_instrument.h antes de avaliar qualquer argumento
+int apm_enabled = 0;
+
 static apm_config_t default_config = {
     .bypass = 1
 };
@@ -32,11 +42,14 @@ void apm_init(apm_config_t* config)
     apm_init_libtrrvmcomm_stubs();
 
     if (apm_config && !apm_config->bypass) {
+        apm_gzip_set_level(apm_config->compression_level);
     #ifdef APM_SPAWN_METRICS
         apm_init_metrics();
     #endif
         apm_init_flush();
+        apm_enabled = 1;
     } else {
+        apm_enabled = 0;
         trrlog(apm_facility, TRRLOG_DEBUG, "APM não habilitado [%s:%d]", __FILE__, __LINE__);
     }
 }
@@ -44,10 +57,17 @@ void apm_init(apm_config_t* config)
 void apm_destroy(void)
 {
     if (apm_config && !apm_config->bypass) {
+        apm_enabled = 0;
+
+        //! as transações que esta thread deixou abertas ainda entram no último envio: a thread de envio esvazia a
+        //! fila antes de terminar
+        apm_orphan_current_transactions();
         apm_destroy_flush();
     #ifdef APM_SPAWN_METRICS
         apm_destroy_metrics();
     #endif
+        //! as duas threads já terminaram; ninguém mais pede a metadata
+        apm_metadata_clear();
         trrlog(apm_facility, TRRLOG_DEBUG, "Finalizando APM [%s:%d]", __FILE__, __LINE__);
     }
 }
@@ -67,21 +87,45 @@ void apm_begin_capture_transaction(const char* name, const char* type, const cha
     }
 }
 
+void apm_continue_capture_transaction(const char* name, const char* type, const char* traceparent, const char* tracestate)
+{
+    if (apm_config && !apm_config->bypass) {
+        apm_continue_capture_transaction_internal(name, type, traceparent, tracestate);
+    }
+}
+
+bool apm_is_sampled(void)
+{
+    apm_transaction_t* transaction = apm_get_current_transaction();
+    return apm_config && !apm_config->bypass && transaction && transaction->sampled;
+}
+
 void apm_end_capture_transaction(const char* outcome, const char* result)
 {
     if (apm_config && !apm_config->bypass) {
+        apm_transaction_t* transaction = apm_get_current_transaction();
         apm_end_capture_transaction_internal(outcome, result);
 
-        apm_add_to_flush_queue(apm_get_current_transaction(), sizeof(apm_transaction_t));
+        //! a transação de fora, se houver, volta a ser a corrente. isso vem antes do finish, que pode liberar a de
+        //! dentro.
         apm_clear_current_transaction();
-        apm_flush();
+        if (apm_finish_transaction(transaction)) {
+            apm_flush();
+        }
     }
 }
 
 void apm_begin_capture_span(const char* name, const char* type, const char* subtype)
 {
     if (apm_config && !apm_config->bypass) {
-        apm_begin_capture_span_internal(name, type, subtype);
+        apm_begin_capture_span_internal(name, type, subtype, NULL);
+    }
+}
+
+void apm_begin_capture_exit_span(const char* name, const char* type, const char* subtype, const char* destination)
+{
+    if (apm_config && !apm_config->bypass) {
+        apm_begin_capture_span_internal(name, type, subtype, destination);
     }
 }
 
@@ -99,6 +143,116 @@ void apm_catch_error(const char* culprit, const char* signal, const char* sig_me
     }
 }
 
+apm_transaction_t* apm_begin_transaction(const char* name, const char* type, const char* trace_id, const char* parent_id)
+{
+    if (apm_config && !apm_config->bypass) {
+        return apm_begin_transaction_internal(name, type, trace_id, parent_id, trace_id ? 1 : -1, -1);
+    }
+    return NULL;
+}
+
+apm_transaction_t* apm_continue_transaction(const char* name, const char* type, const char* traceparent, const char* tracestate)
+{
+    if (apm_config && !apm_config->bypass) {
+        return apm_continue_transaction_internal(name, type, traceparent, tracestate);
+    }
+    return NULL;
+}
+
+bool apm_is_transaction_sampled(apm_transaction_t* transaction)
+{
+    return apm_config && !apm_config->bypass && transaction && transaction->sampled;
+}
+
+void apm_end_transaction(apm_transaction_t* transaction, const char* outcome, const char* result)
+{
+    if (apm_config && !apm_config->bypass && transaction) {
+        apm_end_transaction_internal(transaction, outcome, result);
+
+        //! a transação passa a pertencer à thread de envio, ou é liberada se descartada. o handle deixa de ser
+        //! válido a partir daqui.
+        if (apm_finish_transaction(transaction)) {
+            apm_flush();
+        }
+    }
+}
+
+apm_span_t* apm_begin_span(apm_transaction_t* transaction, apm_span_t* parent, const char* name, const char* type, const char* subtype)
+{
+    if (apm_config && !apm_config->bypass) {
+        return apm_pin_span(apm_begin_span_internal(transaction, parent, name, type, subtype, NULL));
+    }
+    return NULL;
+}
+
+apm_span_t* apm_begin_exit_span(apm_transaction_t* transaction, apm_span_t* parent, const char* name, const char* type, const char* subtype, const char* destination)
+{
+    if (apm_config && !apm_config->bypass) {
+        return apm_pin_span(apm_begin_span_internal(transaction, parent, name, type, subtype, destination));
+    }
+    return NULL;
+}
+
+void apm_end_span(apm_transaction_t* transaction, apm_span_t* span, const char* outcome)
+{
+    if (apm_config && !apm_config->bypass) {
+        apm_end_span_internal(transaction, span, outcome);
+    }
+}
+
+void apm_add_str_to_span(apm_span_t* span, char* value, ...)
+{
+    if (apm_config && !apm_config->bypass) {
+        //! span descartado pelo limite de spans
+        if (!span) {
+            return;
+        }
+
+        va_list args;
+        va_start(args, value);
+        apm_vadd_to_span_context(span, APM_ATTR_STR, value, args);
+        va_end(args);
+    }
+}
+
+void apm_add_int_to_span(apm_span_t* span, double* value, ...)
+{
+    if (apm_config && !apm_config->bypass) {
+        //! span descartado pelo limite de spans
+        if (!span) {
+            return;
+        }
+
+        va_list args;
+        va_start(args, value);
+        apm_vadd_to_span_context(span, APM_ATTR_NUMBER, value, args);
+        va_end(args);
+    }
+}
+
+void apm_add_str_attr_to_span(apm_transaction_t* transaction, apm_span_t* span, apm_attr_key_t key, const char* value)
+{
+    //! span descartado pelo limite de spans
+    if (apm_config && !apm_config->bypass && span) {
+        apm_set_span_attr(transaction, span, key, APM_ATTR_STR, value, 0);
+    }
+}
+
+void apm_add_int_attr_to_span(apm_transaction_t* transaction, apm_span_t* span, apm_attr_key_t key, int64_t value)
+{
+    //! span descartado pelo limite de spans
+    if (apm_config && !apm_config->bypass && span) {
+        apm_set_span_attr(transaction, span, key, APM_ATTR_INT, NULL, value);
+    }
+}
+
+void apm_catch_transaction_error(apm_transaction_t* transaction, apm_span_t* span, const char* culprit, const char* signal, const char* sig_message, const char** stacksym, size_t stack_size, bool handled)
+{
+    if (apm_config && !apm_config->bypass) {
+        apm_catch_transaction_error_internal(transaction, span, culprit, signal, sig_message, stacksym, stack_size, handled);
+    }
+}
+
 apm_config_t* apm_get_config(void)
 {
     return apm_config;
@@ -109,13 +263,38 @@ void apm_get_traceparent_info(const char* traceparent, char** trace_id, char** p
     *trace_id = NULL;
     *parent_id = NULL;
 
-    if (traceparent != NULL) {
-        char trace_id_str[TRACE_ID_LEN+1] = {0};
-        char parent_id_str[SPAN_ID_LEN+1] = {0};
+    //! mantida por compatibilidade: devolve cópias alocadas. apm_parse_traceparent escreve num buffer de quem chama.
+    apm_trace_context_t context;
+    if (apm_parse_traceparent(traceparent, &context) == 0) {
+        *trace_id = dup_value_or_default(context.trace_id, NULL);
+        *parent_id = dup_value_or_default(context.parent_id, NULL);
+    }
+}
 
-        if (sscanf(traceparent, "00-%32[0-9a-fA-F]-%16[0-9a-fA-F]-01", trace_id_str, parent_id_str)) {
-            *trace_id = dup_value_or_default(trace_id_str, NULL);
-            *parent_id = dup_value_or_default(parent_id_str, NULL);
+apm_context_t apm_context_capture(void)
+{
+    apm_context_t context;
+    if (apm_config && !apm_config->bypass) {
+        return apm_context_capture_internal();
+    }
+
+    memset(&context, 0, sizeof(context));
+    return context;
+}
+
+void apm_context_restore(apm_context_t* context)
+{
+    if (apm_config && !apm_config->bypass) {
+        apm_context_restore_internal(context);
+    }
+}
+
+void apm_context_release(apm_context_t* context)
+{
+    if (apm_config && !apm_config->bypass) {
+        //! a última referência pode ser a do contexto: aí é ele quem entrega a transação para o envio
+        if (apm_context_release_internal(context)) {
+            apm_flush();
         }
     }
 }
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <trrapm/apm.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
 #include <trrapm/apm_rest.h>
 #include <trrlog1/trrlog.h>
 
@@ -24,14 +25,14 @@ static apm_facade_t facade[] = {
     { .type = GET_AZURE_CLOUD_METADATA, .url = "/metadata/instance/compute?api-version=2019-08-15", .operation = HTTP_GET },
 };
 
-static RESTResponse* apm_request(apm_endpoint_type_t type, const char* base_url, const char* payload, Headers* headers, int flags);
+static RESTResponse* apm_request(apm_endpoint_type_t type, const char* base_url, const struct iovec* payload, int count, Headers* headers, int flags);
 
-static RESTResponse* apm_request(apm_endpoint_type_t type, const char* base_url, const char* payload, Headers* headers, int flags)
+static RESTResponse* apm_request(apm_endpoint_type_t type, const char* base_url, const struct iovec* payload, int count, Headers* headers, int flags)
 {
     for (int i = 0; i < sizeof(facade) / sizeof(apm_facade_t); i++) {
         if (facade[i].type == type) {
             char* url = build_url(base_url, facade[i].url);
-            RESTResponse* resp = request(facade[i].operation, url, payload, headers, flags);
+            RESTResponse* resp = request_iov(facade[i].operation, url, payload, count, headers, flags);
             free(url);
             return resp;
         }
@@ -39,7 +40,7 @@ static RESTResponse* apm_request(apm_endpoint_type_t type, const char* base_url,
     return NULL;
 }
 
-void apm_create_intake_event_request(char* payload)
+void apm_create_intake_event_request(const apm_payload_t* payload)
 {
     apm_config_t* config = apm_get_config();
     Headers* headers = headers_new();
@@ -47,7 +48,7 @@ void apm_create_intake_event_request(char* payload)
     headers_add_bearer_authorization(headers, config->token);
     headers_add(headers, "Content-Type", "application/x-ndjson");
 
-    RESTResponse* resp = apm_request(POST_INTAKE_EVENT, config->url, payload, headers, REQUEST_COMPRESS);
+    RESTResponse* resp = apm_request(POST_INTAKE_EVENT, config->url, payload->chunks, payload->count, headers, REQUEST_COMPRESS);
     if (!resp || resp->status != 202) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro de comunicação.");
     }
@@ -56,7 +57,7 @@ void apm_create_intake_event_request(char* payload)
     rest_response_free(resp);
 }
 
-void apm_create_intake_metrics_request(char* payload)
+void apm_create_intake_metrics_request(const apm_payload_t* payload)
 {
     apm_config_t* config = apm_get_config();
     Headers* headers = headers_new();
@@ -64,7 +65,7 @@ void apm_create_intake_metrics_request(char* payload)
     headers_add_bearer_authorization(headers, config->token);
     headers_add(headers, "Content-Type", "application/x-ndjson");
 
-    RESTResponse* resp = apm_request(POST_INTAKE_METRICS, config->url, payload, headers, REQUEST_COMPRESS);
+    RESTResponse* resp = apm_request(POST_INTAKE_METRICS, config->url, payload->chunks, payload->count, headers, REQUEST_COMPRESS);
     if (!resp || resp->status != 202) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro de comunicação.");
     }
@@ -80,7 +81,7 @@ char* apm_create_azure_cloud_metadata_request(void)
     Headers* headers = headers_new();
 
     headers_add(headers, "Metadata", "true");
-    RESTResponse* resp = apm_request(GET_AZURE_CLOUD_METADATA, url, NULL, headers, REQUEST_NO_FLAGS);
+    RESTResponse* resp = apm_request(GET_AZURE_CLOUD_METADATA, url, NULL, 0, headers, REQUEST_NO_FLAGS);
     if (!resp || resp->status != 200) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro de comunicação.");
         goto catch;
@@ -0,0 +1,200 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+
+//! alinhamento suficiente para qualquer estrutura do apm (double, uint64_t e ponteiros)
+#define APM_ARENA_ALIGN 16
+#define APM_ARENA_ALIGN_UP(p, a) (((p) + ((a) - 1)) & ~((uintptr_t)(a) - 1))
+
+struct apm_arena_chunk {
+    apm_arena_chunk_t* next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+};
+
+//! blocos devolvidos pelas transações já enviadas. como a thread de envio libera e as threads de trabalho alocam, o
+//! cache é global; o lock é tomado uma vez por bloco, e não por span.
+static pthread_mutex_t cache_mutexh = PTHREAD_MUTEX_INITIALIZER;
+static apm_arena_chunk_t* chunk_cache = NULL;
+static int chunk_cache_size = 0;
+
+static apm_arena_chunk_t* apm_arena_new_chunk(size_t size);
+static void apm_arena_release_chunk(apm_arena_chunk_t* chunk);
+static void* apm_arena_bump(apm_arena_chunk_t* chunk, size_t size, size_t align);
+static void* apm_arena_alloc_aligned(apm_arena_t* arena, size_t size, size_t align);
+
+static apm_arena_chunk_t* apm_arena_new_chunk(size_t size)
+{
+    apm_arena_chunk_t* chunk = NULL;
+
+    if (size == APM_ARENA_CHUNK_SIZE) {
+        pthread_mutex_lock(&cache_mutexh);
+        chunk = chunk_cache;
+        if (chunk) {
+            chunk_cache = chunk->next;
+            chunk_cache_size--;
+        }
+        pthread_mutex_unlock(&cache_mutexh);
+
+        if (chunk) {
+            chunk->next = NULL;
+            chunk->used = 0;
+            return chunk;
+        }
+    }
+
+    chunk = malloc(sizeof(apm_arena_chunk_t) + size + APM_ARENA_ALIGN);
+    if (!chunk) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size + APM_ARENA_ALIGN;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void apm_arena_release_chunk(apm_arena_chunk_t* chunk)
+{
+    if (chunk->size == APM_ARENA_CHUNK_SIZE + APM_ARENA_ALIGN) {
+        pthread_mutex_lock(&cache_mutexh);
+        if (chunk_cache_size < APM_ARENA_CACHE_MAX) {
+            chunk->next = chunk_cache;
+            chunk_cache = chunk;
+            chunk_cache_size++;
+            chunk = NULL;
+        }
+        pthread_mutex_unlock(&cache_mutexh);
+    }
+
+    free(chunk);
+}
+
+static void* apm_arena_bump(apm_arena_chunk_t* chunk, size_t size, size_t align)
+{
+    uintptr_t base = (uintptr_t)chunk->data;
+    uintptr_t ptr = APM_ARENA_ALIGN_UP(base + chunk->used, align);
+
+    if (ptr + size > base + chunk->size) {
+        return NULL;
+    }
+
+    chunk->used = (ptr + size) - base;
+    return memset((void*)ptr, 0, size);
+}
+
+apm_arena_t* apm_arena_new(void)
+{
+    apm_arena_chunk_t* chunk = apm_arena_new_chunk(APM_ARENA_CHUNK_SIZE);
+    if (!chunk) {
+        return NULL;
+    }
+
+    //! a própria arena mora no primeiro bloco, assim criar uma transação custa um único malloc.
+    apm_arena_t* arena = apm_arena_bump(chunk, sizeof(apm_arena_t), APM_ARENA_ALIGN);
+    arena->chunk = chunk;
+    arena->chunks = 1;
+    return arena;
+}
+
+void apm_arena_free(apm_arena_t* arena)
+{
+    if (!arena) {
+        return;
+    }
+
+    //! a arena está dentro de um dos blocos. depois do primeiro free ela não pode mais ser acessada.
+    apm_arena_chunk_t* chunk = arena->chunk;
+    while (chunk) {
+        apm_arena_chunk_t* next = chunk->next;
+        apm_arena_release_chunk(chunk);
+        chunk = next;
+    }
+}
+
+void apm_arena_clear_cache(void)
+{
+    pthread_mutex_lock(&cache_mutexh);
+    apm_arena_chunk_t* chunk = chunk_cache;
+    chunk_cache = NULL;
+    chunk_cache_size = 0;
+    pthread_mutex_unlock(&cache_mutexh);
+
+    while (chunk) {
+        apm_arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void* apm_arena_alloc_aligned(apm_arena_t* arena, size_t size, size_t align)
+{
+    void* ptr = NULL;
+    if (!arena) {
+        return NULL;
+    }
+
+    ptr = apm_arena_bump(arena->chunk, size, align);
+    if (!ptr) {
+        if (size > APM_ARENA_CHUNK_SIZE / 2) {
+            //! alocações grandes ganham um bloco exclusivo, encadeado atrás do corrente, para não desperdiçar o
+            //! espaço que ainda resta nele.
+            apm_arena_chunk_t* chunk = apm_arena_new_chunk(size);
+            if (!chunk) {
+                return NULL;
+            }
+            chunk->next = arena->chunk->next;
+            arena->chunk->next = chunk;
+            ptr = apm_arena_bump(chunk, size, align);
+        }
+        else {
+            apm_arena_chunk_t* chunk = apm_arena_new_chunk(APM_ARENA_CHUNK_SIZE);
+            if (!chunk) {
+                return NULL;
+            }
+            chunk->next = arena->chunk;
+            arena->chunk = chunk;
+            ptr = apm_arena_bump(chunk, size, align);
+        }
+        arena->chunks++;
+    }
+
+    arena->allocs++;
+    return ptr;
+}
+
+void* apm_arena_alloc(apm_arena_t* arena, size_t size)
+{
+    return apm_arena_alloc_aligned(arena, size, APM_ARENA_ALIGN);
+}
+
+char* apm_arena_strdup(apm_arena_t* arena, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    //! strings não precisam de alinhamento
+    char* dup = apm_arena_alloc_aligned(arena, len, 1);
+    if (dup) {
+        memcpy(dup, str, len);
+    }
+    return dup;
+}
+
+char* apm_arena_dup_value_or_default(apm_arena_t* arena, const char* value, const char* def)
+{
+    if (value) {
+        return apm_arena_strdup(arena, value);
+    }
+    else if (def) {
+        return apm_arena_strdup(arena, def);
+    }
+    else {
+        return apm_arena_strdup(arena, "");
+    }
+}
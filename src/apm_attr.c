@@ -0,0 +1,385 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+#include <trrapm/apm_attr.h>
+#include <trrapm/apm_intern.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+
+typedef struct {
+    const char* path[3];
+    apm_attr_type_t type;
+    bool intern; //!< valores de baixa cardinalidade vão para a tabela de strings internadas
+} apm_attr_desc_t;
+
+static const apm_attr_desc_t attr_desc[APM_ATTR_KEYS] = {
+    [APM_ATTR_HTTP_URL]                     = { { "http", "url", NULL }, APM_ATTR_STR, false },
+    [APM_ATTR_HTTP_METHOD]                  = { { "http", "method", NULL }, APM_ATTR_STR, true },
+    [APM_ATTR_HTTP_STATUS_CODE]             = { { "http", "status_code", NULL }, APM_ATTR_INT, false },
+    [APM_ATTR_SERVICE_TARGET_NAME]          = { { "service", "target", "name" }, APM_ATTR_STR, false },
+    [APM_ATTR_SERVICE_TARGET_TYPE]          = { { "service", "target", "type" }, APM_ATTR_STR, true },
+    [APM_ATTR_DESTINATION_SERVICE_NAME]     = { { "destination", "service", "name" }, APM_ATTR_STR, false },
+    [APM_ATTR_DESTINATION_SERVICE_RESOURCE] = { { "destination", "service", "resource" }, APM_ATTR_STR, false },
+    [APM_ATTR_DESTINATION_SERVICE_TYPE]     = { { "destination", "service", "type" }, APM_ATTR_STR, true },
+    [APM_ATTR_DESTINATION_ADDRESS]          = { { "destination", "address", NULL }, APM_ATTR_STR, false },
+    [APM_ATTR_DESTINATION_PORT]             = { { "destination", "port", NULL }, APM_ATTR_INT, false },
+    [APM_ATTR_DB_INSTANCE]                  = { { "db", "instance", NULL }, APM_ATTR_STR, true },
+    [APM_ATTR_DB_STATEMENT]                 = { { "db", "statement", NULL }, APM_ATTR_STR, false },
+    [APM_ATTR_DB_TYPE]                      = { { "db", "type", NULL }, APM_ATTR_STR, true },
+    [APM_ATTR_DB_USER]                      = { { "db", "user", NULL }, APM_ATTR_STR, true },
+    [APM_ATTR_MESSAGE_QUEUE_NAME]           = { { "message", "queue", "name" }, APM_ATTR_STR, true },
+};
+
+//! folha do objeto context: um atributo tipado ou um campo livre, com o caminho completo até ela
+typedef struct {
+    const char* const* path;
+    int depth;
+    const apm_attr_t* attr;
+    const apm_field_t* field;
+} apm_context_leaf_t;
+
+//! folhas guardadas na pilha durante a escrita; spans com mais campos que isso usam o heap
+#define APM_CONTEXT_LEAVES_STACK 32
+
+static apm_attr_t* apm_reserve_span_attr(apm_transaction_t* transaction, apm_span_t* span, apm_attr_key_t key);
+static apm_field_t* apm_reserve_span_field(apm_transaction_t* transaction, apm_span_t* span, const char** keys, int depth);
+static void apm_attrs_to_ndjson(const apm_attr_t* attrs, int count, apm_ndjson_t* writer);
+static int apm_context_leaf_compare(const void* a, const void* b);
+static void apm_context_leaves_to_ndjson(apm_context_leaf_t* leaves, int count, apm_ndjson_t* writer);
+
+
+static apm_attr_t* apm_reserve_span_attr(apm_transaction_t* transaction, apm_span_t* span, apm_attr_key_t key)
+{
+    //! poucos atributos por span: uma busca linear é mais barata que qualquer hash
+    for (int i = 0; i < span->attr_count; i++) {
+        if (span->attrs[i].key == key) {
+            return &span->attrs[i];
+        }
+    }
+
+    if (span->attr_count == span->attr_capacity) {
+        //! o vetor vem da arena; o bloco antigo fica perdido nela até o fim da transação
+        int new_capacity = span->attr_capacity ? span->attr_capacity * 2 : APM_SPAN_ATTRS_INITIAL;
+        apm_attr_t* tmp = apm_arena_alloc(transaction->arena, new_capacity * sizeof(apm_attr_t));
+        if (!tmp) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return NULL;
+        }
+
+        if (span->attr_count) {
+            memcpy(tmp, span->attrs, span->attr_count * sizeof(apm_attr_t));
+        }
+        span->attrs = tmp;
+        span->attr_capacity = new_capacity;
+    }
+
+    apm_attr_t* attr = &span->attrs[span->attr_count++];
+    attr->key = key;
+    return attr;
+}
+
+void apm_set_span_attr(apm_transaction_t* transaction, apm_span_t* span, apm_attr_key_t key, apm_attr_type_t type, const char* str, int64_t number)
+{
+    if (!transaction || !span) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
+        return;
+    }
+
+    if (key < 0 || key >= APM_ATTR_KEYS || attr_desc[key].type != type) {
+        trrlog(apm_facility, TRRLOG_ERR, "Atributo de span inválido (%d). [%s:%d]", key, __FILE__, __LINE__);
+        return;
+    }
+
+    bool locked = apm_lock_transaction(transaction);
+    apm_attr_t* attr = apm_reserve_span_attr(transaction, span, key);
+    if (!attr) {
+        goto finally;
+    }
+
+    attr->type = type;
+    if (type == APM_ATTR_INT) {
+        attr->value.number = number;
+    }
+    else if (attr_desc[key].intern) {
+        attr->value.str = apm_intern_value_or_default(transaction->arena, str, NULL);
+    }
+    else {
+        attr->value.str = apm_arena_dup_value_or_default(transaction->arena, str, NULL);
+    }
+
+finally:
+    apm_unlock_transaction(transaction, locked);
+}
+
+static apm_field_t* apm_reserve_span_field(apm_transaction_t* transaction, apm_span_t* span, const char** keys, int depth)
+{
+    for (int i = 0; i < span->field_count; i++) {
+        apm_field_t* field = &span->fields[i];
+        if (field->depth != depth) {
+            continue;
+        }
+
+        int j = 0;
+        while (j < depth && strcmp(field->path[j], keys[j]) == 0) {
+            j++;
+        }
+        if (j == depth) {
+            return field;
+        }
+    }
+
+    if (span->field_count == span->field_capacity) {
+        int new_capacity = span->field_capacity ? span->field_capacity * 2 : APM_SPAN_FIELDS_INITIAL;
+        apm_field_t* tmp = apm_arena_alloc(transaction->arena, new_capacity * sizeof(apm_field_t));
+        if (!tmp) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return NULL;
+        }
+
+        if (span->field_count) {
+            memcpy(tmp, span->fields, span->field_count * sizeof(apm_field_t));
+        }
+        span->fields = tmp;
+        span->field_capacity = new_capacity;
+    }
+
+    const char** path = apm_arena_alloc(transaction->arena, depth * sizeof(const char*));
+    if (!path) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+        return NULL;
+    }
+
+    //! as chaves se repetem entre spans e transações; o valor é que costuma variar
+    for (int j = 0; j < depth; j++) {
+        path[j] = apm_intern_value_or_default(transaction->arena, keys[j], "");
+    }
+
+    apm_field_t* field = &span->fields[span->field_count++];
+    field->path = path;
+    field->depth = depth;
+    return field;
+}
+
+void apm_set_span_field(apm_transaction_t* transaction, apm_span_t* span, apm_attr_type_t type, const void* value, va_list args)
+{
+    const char* keys[APM_CONTEXT_PATH_MAX];
+    int depth = 0;
+
+    if (!transaction || !span) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
+        return;
+    }
+
+    for (const char* key = va_arg(args, const char*); key; key = va_arg(args, const char*)) {
+        if (depth == APM_CONTEXT_PATH_MAX) {
+            trrlog(apm_facility, TRRLOG_ERR, "Caminho de contexto com mais de %d chaves. [%s:%d]", APM_CONTEXT_PATH_MAX, __FILE__, __LINE__);
+            return;
+        }
+        keys[depth++] = key;
+    }
+
+    if (!depth) {
+        trrlog(apm_facility, TRRLOG_ERR, "Caminho de contexto vazio. [%s:%d]", __FILE__, __LINE__);
+        return;
+    }
+
+    bool locked = apm_lock_transaction(transaction);
+    apm_field_t* field = apm_reserve_span_field(transaction, span, keys, depth);
+    if (!field) {
+        goto finally;
+    }
+
+    field->type = type;
+    if (type == APM_ATTR_NUMBER) {
+        field->value.number = value ? *(const double*)value : 0;
+    }
+    else {
+        field->value.str = apm_arena_dup_value_or_default(transaction->arena, value, NULL);
+    }
+
+finally:
+    apm_unlock_transaction(transaction, locked);
+}
+
+static void apm_attrs_to_ndjson(const apm_attr_t* attrs, int count, apm_ndjson_t* writer)
+{
+    //! as chaves do enum estão agrupadas pelo caminho no json: percorrendo na ordem do enum, cada objeto
+    //! aninhado é aberto uma única vez, sem ordenar nada
+    const apm_attr_t* by_key[APM_ATTR_KEYS] = { NULL };
+    for (int i = 0; i < count; i++) {
+        if (attrs[i].type == APM_ATTR_INT || attrs[i].value.str) {
+            by_key[attrs[i].key] = &attrs[i];
+        }
+    }
+
+    const char* open[2] = { NULL, NULL };
+    int depth = 0;
+    for (int key = 0; key < APM_ATTR_KEYS; key++) {
+        const apm_attr_t* attr = by_key[key];
+        if (!attr) {
+            continue;
+        }
+
+        const apm_attr_desc_t* desc = &attr_desc[key];
+        int levels = desc->path[2] ? 2 : 1;
+
+        //! fecha os objetos abertos que não fazem parte do caminho deste atributo e abre os que faltam
+        int common = 0;
+        while (common < depth && common < levels && strcmp(open[common], desc->path[common]) == 0) {
+            common++;
+        }
+        for (; depth > common; depth--) {
+            apm_ndjson_end_object(writer);
+        }
+        for (; depth < levels; depth++) {
+            apm_ndjson_key(writer, desc->path[depth]);
+            apm_ndjson_begin_object(writer, NULL, 0);
+            open[depth] = desc->path[depth];
+        }
+
+        apm_ndjson_key(writer, desc->path[levels]);
+        if (attr->type == APM_ATTR_INT) {
+            apm_ndjson_int64(writer, NULL, 0, attr->value.number);
+        }
+        else {
+            apm_ndjson_string(writer, NULL, 0, attr->value.str);
+        }
+    }
+
+    for (; depth > 0; depth--) {
+        apm_ndjson_end_object(writer);
+    }
+}
+
+static int apm_context_leaf_compare(const void* a, const void* b)
+{
+    const apm_context_leaf_t* left = a;
+    const apm_context_leaf_t* right = b;
+
+    //! ordem das chaves, nível a nível; um caminho vem antes dos que estão abaixo dele
+    for (int i = 0; i < left->depth && i < right->depth; i++) {
+        int cmp = strcmp(left->path[i], right->path[i]);
+        if (cmp) {
+            return cmp;
+        }
+    }
+    if (left->depth != right->depth) {
+        return left->depth - right->depth;
+    }
+
+    //! no mesmo caminho o atributo tipado vem primeiro e é o que fica
+    return (left->attr ? 0 : 1) - (right->attr ? 0 : 1);
+}
+
+static void apm_context_leaves_to_ndjson(apm_context_leaf_t* leaves, int count, apm_ndjson_t* writer)
+{
+    qsort(leaves, count, sizeof(apm_context_leaf_t), apm_context_leaf_compare);
+
+    //! os objetos abertos são sempre os do caminho da última folha escrita
+    const apm_context_leaf_t* last = NULL;
+    int depth = 0;
+    for (int i = 0; i < count; i++) {
+        const apm_context_leaf_t* leaf = &leaves[i];
+
+        //! o mesmo caminho, ou um caminho abaixo de um valor já escrito, não cabe no objeto: fica o primeiro
+        if (last && last->depth <= leaf->depth) {
+            int j = 0;
+            while (j < last->depth && strcmp(last->path[j], leaf->path[j]) == 0) {
+                j++;
+            }
+            if (j == last->depth) {
+                continue;
+            }
+        }
+
+        int levels = leaf->depth - 1;
+        int common = 0;
+        while (common < depth && common < levels && strcmp(last->path[common], leaf->path[common]) == 0) {
+            common++;
+        }
+        for (; depth > common; depth--) {
+            apm_ndjson_end_object(writer);
+        }
+        for (; depth < levels; depth++) {
+            apm_ndjson_key(writer, leaf->path[depth]);
+            apm_ndjson_begin_object(writer, NULL, 0);
+        }
+
+        apm_ndjson_key(writer, leaf->path[levels]);
+        if (leaf->attr && leaf->attr->type == APM_ATTR_INT) {
+            apm_ndjson_int64(writer, NULL, 0, leaf->attr->value.number);
+        }
+        else if (leaf->attr) {
+            apm_ndjson_string(writer, NULL, 0, leaf->attr->value.str);
+        }
+        else if (leaf->field->type == APM_ATTR_NUMBER) {
+            apm_ndjson_number(writer, NULL, 0, leaf->field->value.number);
+        }
+        else {
+            apm_ndjson_string(writer, NULL, 0, leaf->field->value.str);
+        }
+        last = leaf;
+    }
+
+    for (; depth > 0; depth--) {
+        apm_ndjson_end_object(writer);
+    }
+}
+
+void apm_span_context_to_ndjson(const apm_span_t* span, apm_ndjson_t* writer)
+{
+    if (!span->attr_count && !span->field_count) {
+        return;
+    }
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("context"));
+    if (!span->field_count) {
+        apm_attrs_to_ndjson(span->attrs, span->attr_count, writer);
+        apm_ndjson_end_object(writer);
+        return;
+    }
+
+    //! com campos livres os caminhos são arbitrários: as folhas são ordenadas para que cada objeto aninhado seja
+    //! aberto uma única vez, e o json sai direto delas
+    apm_context_leaf_t stack_leaves[APM_CONTEXT_LEAVES_STACK];
+    apm_context_leaf_t* leaves = stack_leaves;
+    int total = span->attr_count + span->field_count;
+    if (total > APM_CONTEXT_LEAVES_STACK) {
+        leaves = malloc(total * sizeof(apm_context_leaf_t));
+        if (!leaves) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            apm_ndjson_end_object(writer);
+            return;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < span->attr_count; i++) {
+        const apm_attr_t* attr = &span->attrs[i];
+        if (attr->type == APM_ATTR_STR && !attr->value.str) {
+            continue;
+        }
+        const apm_attr_desc_t* desc = &attr_desc[attr->key];
+        leaves[count++] = (apm_context_leaf_t){ desc->path, desc->path[2] ? 3 : 2, attr, NULL };
+    }
+    for (int i = 0; i < span->field_count; i++) {
+        const apm_field_t* field = &span->fields[i];
+        if (field->type == APM_ATTR_STR && !field->value.str) {
+            continue;
+        }
+        leaves[count++] = (apm_context_leaf_t){ field->path, field->depth, NULL, field };
+    }
+
+    apm_context_leaves_to_ndjson(leaves, count, writer);
+    apm_ndjson_end_object(writer);
+
+    if (leaves != stack_leaves) {
+        free(leaves);
+    }
+}
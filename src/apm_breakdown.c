@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_breakdown.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+
+typedef struct {
+    uint32_t hash;
+    char* transaction_type;
+    char* transaction_name;
+    char* span_type;    //!< NULL na entrada da própria transação (transaction.duration.*)
+    char* span_subtype;
+    double count;
+    double sum_us;
+    double breakdown_count;
+} apm_breakdown_entry_t;
+
+//! as threads de trabalho acumulam e a thread de métricas esvazia; o lock é tomado uma vez por transação
+static pthread_mutex_t breakdown_mutexh = PTHREAD_MUTEX_INITIALIZER;
+static apm_breakdown_entry_t* breakdown_table[APM_BREAKDOWN_SLOTS];
+static int breakdown_entries = 0;
+static int breakdown_overflow = 0;
+
+static uint32_t apm_breakdown_hash(const char** keys);
+static apm_breakdown_entry_t* apm_breakdown_find(const char** keys);
+static void apm_breakdown_add(apm_transaction_t* transaction, const char* type, const char* subtype, double count, double sum_us);
+static uint64_t apm_breakdown_covered_ns(uint64_t start, uint64_t end, apm_span_t* children);
+static void apm_breakdown_walk(apm_transaction_t* transaction, apm_span_t* spans, double weight);
+static void apm_breakdown_to_ndjson(apm_breakdown_entry_t* entry, uint64_t timestamp, apm_ndjson_t* writer);
+
+
+static uint32_t apm_breakdown_hash(const char** keys)
+{
+    //! fnv-1a sobre as quatro chaves, com um separador que não aparece em texto
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        for (const unsigned char* p = (const unsigned char*)(keys[i] ? keys[i] : ""); *p; p++) {
+            hash ^= *p;
+            hash *= 16777619u;
+        }
+        hash ^= keys[i] ? 0xff : 0xfe;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static apm_breakdown_entry_t* apm_breakdown_find(const char** keys)
+{
+    size_t len[4];
+    size_t total = 0;
+    uint32_t hash = apm_breakdown_hash(keys);
+
+    for (uint32_t i = 0; i < APM_BREAKDOWN_SLOTS; i++) {
+        apm_breakdown_entry_t** slot = &breakdown_table[(hash + i) & (APM_BREAKDOWN_SLOTS - 1)];
+        apm_breakdown_entry_t* entry = *slot;
+
+        if (entry) {
+            const char* fields[4] = { entry->transaction_type, entry->transaction_name, entry->span_type, entry->span_subtype };
+            bool match = entry->hash == hash;
+            for (int k = 0; match && k < 4; k++) {
+                match = (!fields[k] && !keys[k]) || (fields[k] && keys[k] && strcmp(fields[k], keys[k]) == 0);
+            }
+            if (match) {
+                return entry;
+            }
+            continue;
+        }
+
+        if (breakdown_entries >= APM_BREAKDOWN_MAX_ENTRIES) {
+            if (!breakdown_overflow++) {
+                trrlog(apm_facility, TRRLOG_ERR, "Limite de métricas de breakdown atingido, combinações descartadas.");
+            }
+            return NULL;
+        }
+
+        //! as chaves são copiadas junto com a entrada: os nomes da transação morrem com a arena dela
+        for (int k = 0; k < 4; k++) {
+            len[k] = keys[k] ? strlen(keys[k]) + 1 : 0;
+            total += len[k];
+        }
+
+        entry = calloc(1, sizeof(apm_breakdown_entry_t) + total);
+        if (!entry) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return NULL;
+        }
+
+        char* cursor = (char*)(entry + 1);
+        char** fields[4] = { &entry->transaction_type, &entry->transaction_name, &entry->span_type, &entry->span_subtype };
+        for (int k = 0; k < 4; k++) {
+            if (keys[k]) {
+                memcpy(cursor, keys[k], len[k]);
+                *fields[k] = cursor;
+                cursor += len[k];
+            }
+        }
+
+        entry->hash = hash;
+        *slot = entry;
+        breakdown_entries++;
+        return entry;
+    }
+
+    return NULL;
+}
+
+static void apm_breakdown_add(apm_transaction_t* transaction, const char* type, const char* subtype, double count, double sum_us)
+{
+    const char* keys[4] = { transaction->type, transaction->name, type, type ? subtype : NULL };
+    apm_breakdown_entry_t* entry = apm_breakdown_find(keys);
+    if (entry) {
+        entry->count += count;
+        entry->sum_us += sum_us;
+    }
+}
+
+static uint64_t apm_breakdown_covered_ns(uint64_t start, uint64_t end, apm_span_t* children)
+{
+    //! os filhos estão em ordem de início, então a união dos intervalos sai em uma passada. filhos concorrentes
+    //! (sobrepostos) não são descontados duas vezes.
+    uint64_t covered = 0;
+    uint64_t cursor = start;
+    for (apm_span_t* child = children; child; child = child->next) {
+        uint64_t child_start = child->start_ns < cursor ? cursor : child->start_ns;
+        uint64_t child_end = child->start_ns + child->duration_ns;
+        if (child_end > end) {
+            child_end = end;
+        }
+
+        if (child_end > child_start) {
+            covered += child_end - child_start;
+            cursor = child_end;
+        }
+    }
+
+    return covered;
+}
+
+static void apm_breakdown_walk(apm_transaction_t* transaction, apm_span_t* spans, double weight)
+{
+    for (apm_span_t* span = spans; span; span = span->next) {
+        if (span->composite_count > 0) {
+            //! um span composto representa composite_count chamadas de saída, sem filhos
+            apm_breakdown_add(transaction, span->type, span->subtype, span->composite_count * weight,
+                (double)span->composite_sum_ns / 1000.0 * weight);
+        }
+        else {
+            uint64_t self_ns = span->duration_ns
+                - apm_breakdown_covered_ns(span->start_ns, span->start_ns + span->duration_ns, span->children);
+            apm_breakdown_add(transaction, span->type, span->subtype, weight, (double)self_ns / 1000.0 * weight);
+        }
+
+        apm_breakdown_walk(transaction, span->children, weight);
+    }
+}
+
+void apm_record_breakdown(apm_transaction_t* transaction)
+{
+    if (!transaction) {
+        return;
+    }
+
+    const char* keys[4] = { transaction->type, transaction->name, NULL, NULL };
+
+    pthread_mutex_lock(&breakdown_mutexh);
+
+    //! a duração é conhecida para todas as transações, inclusive as não amostradas
+    apm_breakdown_entry_t* entry = apm_breakdown_find(keys);
+    if (entry) {
+        entry->count += 1;
+        entry->sum_us += (double)transaction->duration_ns / 1000.0;
+    }
+
+    //! as não amostradas não têm spans. o tempo próprio sai das amostradas, ponderado pela taxa de amostragem.
+    if (transaction->sampled) {
+        double weight = transaction->sample_rate > 0 ? 1.0 / transaction->sample_rate : 1.0;
+        if (entry) {
+            entry->breakdown_count += weight;
+        }
+
+        uint64_t self_ns = transaction->duration_ns - apm_breakdown_covered_ns(transaction->start_ns,
+            transaction->start_ns + transaction->duration_ns, transaction->children);
+        apm_breakdown_add(transaction, "app", NULL, weight, (double)self_ns / 1000.0 * weight);
+        apm_breakdown_walk(transaction, transaction->children, weight);
+    }
+
+    pthread_mutex_unlock(&breakdown_mutexh);
+}
+
+static void apm_breakdown_to_ndjson(apm_breakdown_entry_t* entry, uint64_t timestamp, apm_ndjson_t* writer)
+{
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("metricset"));
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), timestamp);
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), entry->transaction_type ? entry->transaction_type : "");
+    apm_ndjson_string(writer, APM_NDJSON_KEY("name"), entry->transaction_name ? entry->transaction_name : "");
+    apm_ndjson_end_object(writer);
+
+    if (entry->span_type) {
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("span"));
+        apm_ndjson_string(writer, APM_NDJSON_KEY("type"), entry->span_type);
+        if (entry->span_subtype && entry->span_subtype[0]) {
+            apm_ndjson_string(writer, APM_NDJSON_KEY("subtype"), entry->span_subtype);
+        }
+        apm_ndjson_end_object(writer);
+
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("samples"));
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("span.self_time.count"));
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), entry->count);
+        apm_ndjson_end_object(writer);
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("span.self_time.sum.us"));
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), entry->sum_us);
+        apm_ndjson_end_object(writer);
+        apm_ndjson_end_object(writer);
+    }
+    else {
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("samples"));
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction.duration.count"));
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), entry->count);
+        apm_ndjson_end_object(writer);
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction.duration.sum.us"));
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), entry->sum_us);
+        apm_ndjson_end_object(writer);
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction.breakdown.count"));
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), entry->breakdown_count);
+        apm_ndjson_end_object(writer);
+        apm_ndjson_end_object(writer);
+    }
+
+    apm_ndjson_end_event(writer);
+}
+
+void apm_dump_breakdown(uint64_t timestamp, apm_ndjson_t* writer)
+{
+    apm_breakdown_entry_t* entries[APM_BREAKDOWN_SLOTS];
+
+    //! a tabela é trocada por uma vazia sob o lock; o json é montado fora dele
+    pthread_mutex_lock(&breakdown_mutexh);
+    memcpy(entries, breakdown_table, sizeof(entries));
+    memset(breakdown_table, 0, sizeof(breakdown_table));
+    breakdown_entries = 0;
+    breakdown_overflow = 0;
+    pthread_mutex_unlock(&breakdown_mutexh);
+
+    for (int i = 0; i < APM_BREAKDOWN_SLOTS; i++) {
+        if (!entries[i]) {
+            continue;
+        }
+
+        if (writer) {
+            apm_breakdown_to_ndjson(entries[i], timestamp, writer);
+        }
+
+        free(entries[i]);
+    }
+}
+
+void apm_breakdown_clear(void)
+{
+    apm_dump_breakdown(0, NULL);
+}
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_context.h>
+#include <trrapm/apm_internal.h>
+
+apm_context_t apm_context_capture_internal(void)
+{
+    apm_context_t context;
+    memset(&context, 0, sizeof(context));
+
+    apm_transaction_t* transaction = apm_get_current_transaction();
+    if (!transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
+        return context;
+    }
+
+    apm_span_stack_t* stack = apm_get_span_stack();
+    context.transaction = transaction;
+    context.trace_id = transaction->trace_id;
+    context.in_span = stack->depth > 0;
+    context.span = context.in_span ? stack->spans[stack->depth - 1] : NULL;
+
+    bool locked = apm_lock_transaction(transaction);
+    if (context.span) {
+        //! o span capturado não pode voltar para o pool (compressão, duração mínima) enquanto pode ganhar filhos
+        context.span->captured = true;
+    }
+    __atomic_add_fetch(&transaction->refs, 1, __ATOMIC_ACQ_REL);
+    apm_unlock_transaction(transaction, locked);
+
+    return context;
+}
+
+void apm_context_restore_internal(apm_context_t* context)
+{
+    if (!context || !context->transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Contexto vazio. [%s:%d]", __FILE__, __LINE__);
+        return;
+    }
+
+    if (context->restored) {
+        trrlog(apm_facility, TRRLOG_ERR, "Contexto já restaurado. [%s:%d]", __FILE__, __LINE__);
+        return;
+    }
+
+    //! a thread ganha uma pilha vazia; a dela fica guardada no contexto até o release
+    context->saved_transaction = apm_get_current_transaction();
+    context->saved_restored = apm_get_restored_transaction();
+    memset(&context->saved_stack, 0, sizeof(context->saved_stack));
+    apm_swap_span_stack(&context->saved_stack);
+    apm_set_current_transaction(context->transaction);
+    apm_set_restored_transaction(context->transaction);
+    context->restored = true;
+
+    if (context->in_span) {
+        if (apm_reserve_span_stack() != 0) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar pilha de spans. [%s:%d]", __FILE__, __LINE__);
+            return;
+        }
+
+        apm_span_stack_t* stack = apm_get_span_stack();
+        stack->spans[stack->depth++] = context->span;
+    }
+}
+
+bool apm_context_release_internal(apm_context_t* context)
+{
+    if (!context || !context->transaction) {
+        return false;
+    }
+
+    if (context->restored) {
+        //! devolve a pilha da thread; a da continuação vem para o contexto e é descartada
+        apm_swap_span_stack(&context->saved_stack);
+        free(context->saved_stack.spans);
+        memset(&context->saved_stack, 0, sizeof(context->saved_stack));
+
+        apm_set_current_transaction(context->saved_transaction);
+        apm_set_restored_transaction(context->saved_restored);
+        context->saved_transaction = NULL;
+        context->saved_restored = NULL;
+        context->restored = false;
+    }
+
+    apm_transaction_t* transaction = context->transaction;
+    context->transaction = NULL;
+    context->span = NULL;
+    context->trace_id = NULL;
+
+    //! se esta era a última referência, a transação já terminou e é decidida aqui
+    return apm_finish_transaction(transaction);
+}
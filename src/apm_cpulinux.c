@@ -4,6 +4,7 @@
 #include <unistd.h>
 
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
 #include <trrlog1/trrlog.h>
 
 #define SYS_STATS "/proc/stat"
@@ -74,44 +75,41 @@ void apm_free_process_stats(apm_process_stats_t* stats)
     free(stats);
 }
 
-char* apm_stats_to_json(apm_stats_t* stats)
+void apm_stats_to_ndjson(apm_stats_t* stats, apm_ndjson_t* writer)
 {
-    //! vamos converter para json
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("metricset"));
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), (uint64_t)stats->timestamp);
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("samples"));
 
-    cJSON* json = cJSON_CreateObject();
-    cJSON* fld_metricset = cJSON_AddObjectToObject(json, "metricset");
-
-    cJSON_AddNumberToObject(fld_metricset, "timestamp", stats->timestamp);
-    cJSON* fld_samples = cJSON_AddObjectToObject(fld_metricset, "samples");
-
-    cJSON* fld_stat1 = cJSON_AddObjectToObject(fld_samples, "system.cpu.total.norm.pct");
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("system.cpu.total.norm.pct"));
     if (stats->system->cpu_total == 0) {
-        cJSON_AddNumberToObject(fld_stat1, "value", 0);
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), 0);
     } else {
-        cJSON_AddNumberToObject(fld_stat1, "value", stats->system->cpu_usage / stats->system->cpu_total);
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), stats->system->cpu_usage / stats->system->cpu_total);
     }
-    cJSON_AddStringToObject(fld_stat1, "type", "gauge");
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), "gauge");
+    apm_ndjson_end_object(writer);
 
-    cJSON* fld_stat2 = cJSON_AddObjectToObject(fld_samples, "system.process.cpu.total.norm.pct");
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("system.process.cpu.total.norm.pct"));
     if (stats->system->cpu_total == 0) {
-        cJSON_AddNumberToObject(fld_stat2, "value", 0);
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), 0);
     } else {
-        cJSON_AddNumberToObject(fld_stat2, "value", stats->process->proc_total_time / stats->system->cpu_total);
+        apm_ndjson_number(writer, APM_NDJSON_KEY("value"), stats->process->proc_total_time / stats->system->cpu_total);
     }
-    cJSON_AddStringToObject(fld_stat2, "type", "gauge");
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), "gauge");
+    apm_ndjson_end_object(writer);
 
-    cJSON* fld_stat3 = cJSON_AddObjectToObject(fld_samples, "system.process.memory.size");
-    cJSON_AddNumberToObject(fld_stat3, "value", stats->process->vsize);
-    cJSON_AddStringToObject(fld_stat3, "type", "gauge");
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("system.process.memory.size"));
+    apm_ndjson_number(writer, APM_NDJSON_KEY("value"), stats->process->vsize);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), "gauge");
+    apm_ndjson_end_object(writer);
 
     long page_size = sysconf(_SC_PAGE_SIZE);
-    cJSON* fld_stat4 = cJSON_AddObjectToObject(fld_samples, "system.process.memory.rss.bytes");
-    cJSON_AddNumberToObject(fld_stat4, "value", stats->process->rss * page_size);
-    cJSON_AddStringToObject(fld_stat4, "type", "gauge");
-
-    char* payload = cJSON_PrintUnformatted(json);
-
-    cJSON_Delete(json);
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("system.process.memory.rss.bytes"));
+    apm_ndjson_number(writer, APM_NDJSON_KEY("value"), stats->process->rss * page_size);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), "gauge");
+    apm_ndjson_end_object(writer);
 
-    return payload;
+    apm_ndjson_end_object(writer);
+    apm_ndjson_end_event(writer);
 }
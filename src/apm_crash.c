@@ -9,6 +9,7 @@
 
 #include <trrlog/trrlog.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
 
 #define CALL_STACK_MAX 32
 
@@ -25,6 +26,9 @@ void apm_handle_exception_cb(int signo, siginfo_t* info, void* secret)
     const char* signal = NULL;
     const char* sig_message = NULL;
 
+    //! a thread pode ter sido interrompida segurando o lock da transação; daqui em diante ele é só tentado
+    apm_enter_crash_handler();
+
     switch (signo) {
         case SIGSEGV:
             signal = "SIGSEGV";
@@ -60,9 +64,9 @@ static void apm_crash_backend_exec(void)
 
     //! temos um contexto altamente complicado aqui, onde o curl pode estar travado. vamos gerar o payload e jogar para
     //! o curl externo da máquina executar esta última chamada antes de morrer. se não for possível executar, paciência.
-    char* payload = apm_create_payload(apm_get_current_transaction());
-    if (!payload) {
-        goto finally;
+    apm_payload_t payload;
+    if (apm_create_payload(apm_get_current_transaction(), &payload) != 0) {
+        return;
     }
 
     apm_config_t* config = apm_get_config();
@@ -80,12 +84,14 @@ static void apm_crash_backend_exec(void)
     }
 
     // Write your raw NDJSON payload (uncompressed)
-    fprintf(pipe, "%s", payload);
+    for (int i = 0; i < payload.count; i++) {
+        fwrite(payload.chunks[i].iov_base, 1, payload.chunks[i].iov_len, pipe);
+    }
     fflush(pipe); // Garante envio antes de fechar
 
     //! Vamos acreditar que foi .. o contexto de pids pode estar corrompido.
     fclose(pipe);
 
 finally:
-    free(payload);
+    apm_payload_free(&payload);
 }
\ No newline at end of file
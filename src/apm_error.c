@@ -2,91 +2,106 @@
 #include <stdlib.h>
 #include <string.h>
 #include <execinfo.h>
-#include <sys/time.h>
 
 #include <trrlog1/trrlog.h>
-#include <trrmap/trrmap.h>
+#include <trrapm/apm_arena.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
 
 #define CALL_STACK_MAX 32
 
-apm_error_t* apm_new_error(void)
+static void apm_stacktrace_to_ndjson(apm_error_t* error, apm_ndjson_t* writer);
+
+
+apm_error_t* apm_new_error(apm_transaction_t* transaction)
 {
-    struct timeval tv;
-    apm_error_t* error = calloc(1, sizeof(apm_error_t));
+    apm_error_t* error = apm_arena_alloc(transaction->arena, sizeof(apm_error_t));
     if (!error) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
-        goto catch;
-    }    
+        return NULL;
+    }
 
-    error->id = generate_id(ERROR_ID_LEN);
+    error->id = apm_arena_alloc(transaction->arena, ERROR_ID_LEN + 1);
     if (!error->id) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao gerar id único para o error.");
-        goto catch;
-    }
-
-    if (gettimeofday(&tv, NULL) != 0) {
-        trrlog(apm_facility, TRRLOG_ERR, "Erro ao obter horário da máquina.");
-    }
-    else {
-        error->timestamp = MICROS(tv);
+        return NULL;
     }
+    apm_generate_id(error->id, ERROR_ID_LEN);
 
-    error->exception.stacktrace = trrmap_create_default();
-
-    list_t* list = trrmap_list_create_default();
-    trrmap_insert(error->exception.stacktrace, TRRMAP_VALUE_LIST, list, "stacktrace", NULL);
+    error->timestamp_ns = apm_monotonic_ns();
 
-    goto finally;
-catch:
-    apm_free_error(error);
-    free(error);
-    error = NULL;
-finally:
     return error;
 }
 
-void apm_free_error(apm_error_t* error)
-{
-    if (error) {
-        free(error->id);
-        free(error->transaction_id);
-        free(error->trace_id);
-        free(error->parent_id);
-        free(error->culprit);
-        free(error->exception.type);
-        free(error->exception.message);
-        trrmap_free((void**)&error->exception.stacktrace);
-    }
-}
-
 void apm_catch_error_internal(const char* culprit, const char* signal, const char* sig_message, const char** stacksym, size_t stack_size, bool handled)
 {
     void* callstack[CALL_STACK_MAX] = {0};
+    char** backtrace_sym = NULL;
     int stack_idx = 1;
-    apm_error_t* new_error = NULL;
     apm_transaction_t* current_transaction = apm_get_current_transaction();
     if (!current_transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
         return;
     }
 
-    trrlog(apm_facility, TRRLOG_DEBUG, "Capturando erro [%s:%d]", __FILE__, __LINE__);
+    //! o backtrace é feito aqui, e não em apm_catch_error_on_internal, para que os índices 0 e 1 continuem sendo esta
+    //! função e a apm_catch_error.
+    if (!stacksym) {
+        stack_size = backtrace(callstack, CALL_STACK_MAX);
+        backtrace_sym = backtrace_symbols(callstack, stack_size);
+        stacksym = (const char**)backtrace_sym;
+        stack_idx++;
+    }
 
-    new_error = apm_new_error();
-    new_error->exception.handled = handled;
-    new_error->exception.type = dup_value_or_default(signal, "???");
-    new_error->exception.message = dup_value_or_default(sig_message, "???");
-    new_error->transaction_id = dup_value_or_default(current_transaction->id, NULL);
-    new_error->trace_id = dup_value_or_default(current_transaction->trace_id, NULL);
+    apm_catch_error_on_internal(current_transaction, apm_get_active_span(current_transaction), culprit, signal, sig_message, stacksym, stack_size, stack_idx, handled);
+
+    free(backtrace_sym);
+}
+
+void apm_catch_transaction_error_internal(apm_transaction_t* transaction, apm_span_t* span, const char* culprit, const char* signal, const char* sig_message, const char** stacksym, size_t stack_size, bool handled)
+{
+    void* callstack[CALL_STACK_MAX] = {0};
+    char** backtrace_sym = NULL;
+    int stack_idx = 1;
 
+    //! mesmo esquema da apm_catch_error_internal: índices 0 e 1 são esta função e a apm_catch_transaction_error.
     if (!stacksym) {
         stack_size = backtrace(callstack, CALL_STACK_MAX);
-        stacksym = backtrace_symbols(callstack, stack_size);
+        backtrace_sym = backtrace_symbols(callstack, stack_size);
+        stacksym = (const char**)backtrace_sym;
         stack_idx++;
     }
 
-    //! Vamos olhar a partir do índice 2, pois o índice 1 é esta função, e o indíce 0 é o próprio backtrace
+    apm_catch_error_on_internal(transaction, span, culprit, signal, sig_message, stacksym, stack_size, stack_idx, handled);
+
+    free(backtrace_sym);
+}
+
+void apm_catch_error_on_internal(apm_transaction_t* transaction, apm_span_t* span, const char* culprit, const char* signal, const char* sig_message, const char** stacksym, size_t stack_size, int stack_idx, bool handled)
+{
+    apm_error_t* new_error = NULL;
+    if (!transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
+        return;
+    }
+
+    trrlog(apm_facility, TRRLOG_DEBUG, "Capturando erro [%s:%d]", __FILE__, __LINE__);
+
+    //! o erro vai para a arena e para a lista da transação, que uma continuação em outra thread pode estar usando
+    bool locked = apm_lock_transaction(transaction);
+    new_error = apm_new_error(transaction);
+    if (!new_error) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar erro. [%s:%d]", __FILE__, __LINE__);
+        goto finally;
+    }
+
+    new_error->exception.handled = handled;
+    new_error->exception.type = apm_arena_dup_value_or_default(transaction->arena, signal, "???");
+    new_error->exception.message = apm_arena_dup_value_or_default(transaction->arena, sig_message, "???");
+    new_error->transaction_id = transaction->id;
+    new_error->trace_id = transaction->trace_id;
+
+    //! stack_idx pula os frames do próprio apm (as funções que chamaram o backtrace)
     for (int i=stack_idx; i < stack_size; i++) {
         char* binary = NULL;
         char* function = NULL;
@@ -95,10 +110,10 @@ void apm_catch_error_internal(const char* culprit, const char* signal, const cha
         trrlog(apm_facility, TRRLOG_DEBUG, "#%d %s", i-1, stacksym[i]);
         get_function_location_from_stack(stacksym[i], &binary, &function, &location, &lineno);
 
-        apm_add_to_stacktrace(new_error, binary, location, function, 0);
+        apm_add_to_stacktrace(transaction, new_error, binary, location, function, 0);
 
         if (i==stack_idx) {
-            new_error->culprit = dup_value_or_default(culprit, binary);
+            new_error->culprit = apm_arena_dup_value_or_default(transaction->arena, culprit, binary);
         }
 
         free(binary);
@@ -107,115 +122,94 @@ void apm_catch_error_internal(const char* culprit, const char* signal, const cha
         free(lineno);
     }
 
-    if (current_transaction->span_depth == 0) {
-        new_error->parent_id = dup_value_or_default(current_transaction->id, NULL);
-    } else {
-        //! Estou apenas com um span_depth
-        apm_span_t* current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-        new_error->parent_id = dup_value_or_default(current_span->id, NULL);
+    new_error->parent_id = span ? span->id : transaction->id;
+    if (span) {
+        //! um span com erro nunca é descartado por ser rápido
+        span->error_count++;
     }
 
-    if (!current_transaction->error) {
-        current_transaction->error = Lopen();
+    if (transaction->last_error) {
+        transaction->last_error->next = new_error;
+    } else {
+        transaction->error = new_error;
     }
-    Linsert(current_transaction->error, (char*)new_error, sizeof(apm_error_t), 1);
-    free(new_error);
+    transaction->last_error = new_error;
+
+finally:
+    apm_unlock_transaction(transaction, locked);
 }
 
-void apm_add_to_stacktrace(apm_error_t* error, const char* binary, const char* filename, const char* function, int lineno)
+void apm_add_to_stacktrace(apm_transaction_t* transaction, apm_error_t* error, const char* binary, const char* filename, const char* function, int lineno)
 {
-    hashmap_t* stacktrace = trrmap_create_default();
-    if (!stacktrace) {
-        return;
-    }
+    if (error->exception.frame_count == error->exception.frame_capacity) {
+        //! mesmo esquema dos atributos do span: o vetor antigo fica na arena até o fim da transação
+        int new_capacity = error->exception.frame_capacity ? error->exception.frame_capacity * 2 : CALL_STACK_MAX;
+        apm_stack_frame_t* tmp = apm_arena_alloc(transaction->arena, new_capacity * sizeof(apm_stack_frame_t));
+        if (!tmp) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return;
+        }
 
-    if (function) {
-        trrmap_insert(stacktrace, TRRMAP_VALUE_STR, (void*)function, "function", NULL);
+        if (error->exception.frame_count) {
+            memcpy(tmp, error->exception.frames, error->exception.frame_count * sizeof(apm_stack_frame_t));
+        }
+        error->exception.frames = tmp;
+        error->exception.frame_capacity = new_capacity;
     }
 
+    apm_stack_frame_t* frame = &error->exception.frames[error->exception.frame_count++];
+    //! sem símbolo o frame sai sem function, como antes
+    frame->function = function ? apm_arena_strdup(transaction->arena, function) : NULL;
+
     if (filename && filename[0] != '?') {
-        trrmap_insert(stacktrace, TRRMAP_VALUE_STR, (void*)filename, "filename", NULL);
-    }
-    else if (binary) {
-        trrmap_insert(stacktrace, TRRMAP_VALUE_STR, (void*)binary, "filename", NULL);
+        frame->filename = apm_arena_dup_value_or_default(transaction->arena, filename, NULL);
     }
     else {
-        trrmap_insert(stacktrace, TRRMAP_VALUE_STR, "unknown", "filename", NULL);
-    }
-
-    list_t* list = NULL;
-    if (trrmap_search(error->exception.stacktrace, (void**)&list, "stacktrace", NULL)) {
-        trrmap_list_append_map(list, stacktrace);
+        frame->filename = apm_arena_dup_value_or_default(transaction->arena, binary, "unknown");
     }
 }
 
-void apm_dump_error(LIST errorlist, char** buffer)
+void apm_dump_error(apm_transaction_t* transaction, apm_error_t* errors, apm_ndjson_t* writer)
 {
-    if (!buffer) {
+    if (!writer) {
         return;
     }
 
-    Lwalk(errorlist, LARGHOME);
-    do {
-        apm_error_t* error = (apm_error_t*)Lcurrent(errorlist);
-        if (!error) {
-            continue;
-        }
-
-        //! vamos converter para json
-        char* partial_buffer = apm_error_to_json(error);
-        apm_free_error(error);
-        
-        if (partial_buffer) {
-            char *tmp = realloc(*buffer, strlen(*buffer) + strlen(partial_buffer) + 2);
-            if (tmp) {
-                *buffer = tmp;
-                strcat(*buffer, partial_buffer);
-                strcat(*buffer, "\n");
-            }
-            free(partial_buffer);
-        }
-    } while (!Lwalk(errorlist, 1));
+    for (apm_error_t* error = errors; error; error = error->next) {
+        apm_error_to_ndjson(transaction, error, writer);
+    }
 }
 
-char* apm_error_to_json(apm_error_t* error)
+static void apm_stacktrace_to_ndjson(apm_error_t* error, apm_ndjson_t* writer)
 {
-    //! vamos converter para json
-    cJSON* json = cJSON_CreateObject();
-    if (!json) {
-        goto catch;
-    }
-
-    cJSON* fld_error = cJSON_AddObjectToObject(json, "error");
-    cJSON_AddStringToObject(fld_error, "id", error->id);
-    cJSON_AddStringToObject(fld_error, "trace_id", error->trace_id);
-    cJSON_AddStringToObject(fld_error, "transaction_id", error->transaction_id);
-    cJSON_AddStringToObject(fld_error, "parent_id", error->parent_id);
-    cJSON_AddNumberToObject(fld_error, "timestamp", error->timestamp);
-    cJSON_AddStringToObject(fld_error, "culprit", error->culprit);
-
-    cJSON* fld_exception = cJSON_AddObjectToObject(fld_error, "exception");
-    cJSON_AddStringToObject(fld_exception, "message", error->exception.message);
-    cJSON_AddStringToObject(fld_exception, "type", error->exception.type);
-    cJSON_AddBoolToObject(fld_exception, "handled", error->exception.handled);
-
-    char* stacktrace_str = trrmap_serialize_json(error->exception.stacktrace);
-    if (stacktrace_str) {
-        cJSON* fld_stacktrace = cJSON_Parse(stacktrace_str);
-        if (fld_stacktrace) {
-            cJSON_AddItemToObject(fld_exception, "stacktrace", cJSON_GetObjectItem(fld_stacktrace, "stacktrace"));
-        }
-        else {
-            trrlog(apm_facility, TRRLOG_ERR, "Erro ao fazer o parser do stacktrace de erro.");
-        }
-
-        free(stacktrace_str);
-    }
+    apm_ndjson_begin_array(writer, APM_NDJSON_KEY("stacktrace"));
+    for (int i = 0; i < error->exception.frame_count; i++) {
+        apm_stack_frame_t* frame = &error->exception.frames[i];
+        apm_ndjson_begin_object(writer, NULL, 0);
+        apm_ndjson_string(writer, APM_NDJSON_KEY("function"), frame->function);
+        apm_ndjson_string(writer, APM_NDJSON_KEY("filename"), frame->filename);
+        apm_ndjson_end_object(writer);
+    }
+    apm_ndjson_end_array(writer);
+}
 
-    char* payload = cJSON_PrintUnformatted(json);
-    goto finally;
-catch:
-    cJSON_Delete(json);
-finally:
-    return payload;
+void apm_error_to_ndjson(apm_transaction_t* transaction, apm_error_t* error, apm_ndjson_t* writer)
+{
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("error"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("id"), error->id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("trace_id"), error->trace_id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("transaction_id"), error->transaction_id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("parent_id"), error->parent_id);
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), apm_transaction_wall_time(transaction, error->timestamp_ns));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("culprit"), error->culprit);
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("exception"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("message"), error->exception.message);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), error->exception.type);
+    apm_ndjson_bool(writer, APM_NDJSON_KEY("handled"), error->exception.handled);
+
+    apm_stacktrace_to_ndjson(error, writer);
+    apm_ndjson_end_object(writer);
+
+    apm_ndjson_end_event(writer);
 }
@@ -0,0 +1,117 @@
+#include <stdint.h>
+
+#include <trrapm/apm_escape.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define APM_ESCAPE_X86 1
+#endif
+
+typedef const char* (*apm_escape_scan_fn)(const char* s);
+
+//! bytes que o json exige escapar: aspas, barra invertida e os caracteres de controle (inclusive o '\0')
+static const unsigned char escape_table[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+};
+
+static const char* apm_escape_scan_scalar(const char* s);
+#ifdef APM_ESCAPE_X86
+static const char* apm_escape_scan_sse2(const char* s);
+static const char* apm_escape_scan_avx2(const char* s);
+#endif
+static const char* apm_escape_scan_resolve(const char* s);
+
+//! começa no resolvedor, que troca o ponteiro pela melhor versão da cpu na primeira chamada
+static apm_escape_scan_fn escape_scan = apm_escape_scan_resolve;
+
+
+static const char* apm_escape_scan_scalar(const char* s)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    while (!escape_table[*p]) {
+        p++;
+    }
+    return (const char*)p;
+}
+
+#ifdef APM_ESCAPE_X86
+//! as varreduras vetoriais leem blocos alinhados, que nunca cruzam uma página: ler além do '\0' dentro do bloco é
+//! seguro, mas o ASan não sabe disso
+__attribute__((target("sse2"), no_sanitize_address))
+static const char* apm_escape_scan_sse2(const char* s)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    uintptr_t misalign = (uintptr_t)s & 15;
+    const char* p = s - misalign;
+    unsigned mask = 0xffffu << misalign;
+
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i*)p);
+        //! max(v, 0x1f) == 0x1f é a comparação sem sinal v <= 0x1f, que o SSE2 não tem
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                   _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        mask &= (unsigned)_mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+        mask = 0xffffu;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* apm_escape_scan_avx2(const char* s)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+
+    uintptr_t misalign = (uintptr_t)s & 31;
+    const char* p = s - misalign;
+    unsigned mask = 0xffffffffu << misalign;
+
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                      _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        mask &= (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+        mask = 0xffffffffu;
+    }
+}
+#endif
+
+static const char* apm_escape_scan_resolve(const char* s)
+{
+    apm_escape_scan_fn scan = apm_escape_scan_scalar;
+
+#ifdef APM_ESCAPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan = apm_escape_scan_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        scan = apm_escape_scan_sse2;
+    }
+#endif
+
+    //! threads que cheguem aqui juntas escrevem o mesmo valor
+    __atomic_store_n(&escape_scan, scan, __ATOMIC_RELAXED);
+    return scan(s);
+}
+
+const char* apm_escape_scan(const char* s)
+{
+    return __atomic_load_n(&escape_scan, __ATOMIC_RELAXED)(s);
+}
@@ -1,3 +1,5 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,8 +8,15 @@
 #include <trrutil/ndtlist.h>
 
 #include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+#include <trrapm/apm_breakdown.h>
+#include <trrapm/apm_gzip.h>
+#include <trrapm/apm_histogram.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+#include <trrapm/apm_payload.h>
 #include <trrapm/apm_rest.h>
+#include <trrapm/apm_sampler.h>
 
 static pthread_t threadh;
 static pthread_mutex_t mutexh;
@@ -19,7 +28,9 @@ static int __thread_init = 0;
 static int __thread_ready = 0;
 static int __thread_destroy = 0;
 
-static char* metadata = NULL;
+//! contadores da decisão de envio, lidos por apm_get_transactions_kept/dropped
+static uint64_t transactions_kept = 0;
+static uint64_t transactions_dropped = 0;
 
 /**
  * @brief Background thread that sends completed APM transactions to the server.
@@ -51,16 +62,14 @@ static char* metadata = NULL;
  */
 static void* apm_flush_thread(void* arg);
 
+//! envia e libera a primeira transação da fila. retorna false se a fila estava vazia.
+static bool apm_flush_queued_transaction(void);
+
 void apm_init_flush(void)
 {
     if (__thread_init++ == 0) {
-        apm_metadata_t* metadatat = apm_new_metadata();
-        if (metadatat == NULL) {
-            trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar estrutura de metadata");
-            return NULL;
-        }
-
-        apm_dump_metadata(metadatat, &metadata);
+        //! a metadata (inclusive a consulta à nuvem) é montada aqui, fora do caminho do primeiro envio
+        apm_metadata_release(apm_metadata_acquire());
 
         if (pthread_mutex_init(&mutexh, NULL) != 0) {
             trrlog(apm_facility, TRRLOG_ERR, "erro ao criar mutex interno [%s:%d]", __FILE__, __LINE__);
@@ -104,6 +113,9 @@ void apm_destroy_flush(void)
 
         pthread_cond_destroy(&condh);
         pthread_mutex_destroy(&mutexh);
+
+        apm_arena_clear_cache();
+        apm_sampler_clear();
     }
 }
 
@@ -112,30 +124,46 @@ static void* apm_flush_thread(void* arg)
     while (1) {
         apm_wait_flush();
 
+        //! um sinal pode chegar com várias transações na fila: ela é esvaziada antes de voltar a esperar
+        while (apm_flush_queued_transaction()) {
+        }
+
         if (__thread_destroy) {
+            //! as transações órfãs que apm_destroy enfileirou logo antes de sinalizar também são enviadas
+            while (apm_flush_queued_transaction()) {
+            }
             trrlog(apm_facility, TRRLOG_DEBUG, "Destruindo thread");
             break;
         }
+    }
 
-        apm_lock_flush();
-        Lwalk(transaction_queue, LARGHOME);
-        apm_transaction_t* transaction = (apm_transaction_t*)Lcurrent(transaction_queue);
-        apm_unlock_flush();
+    apm_gzip_clear();
 
-        apm_flush_transaction_internal(transaction);
+    return NULL;
+}
 
-        apm_lock_flush();
-        //! Caso o POST para o APM demore demais, a thread principal pode adicionar uma nova transação na queue.
-        //! Neste caso, a posição corrente acaba apontando para esta nova transação. Assim precisamos forçar o retorno para
-        //! a posição 0 da queue.
-        Lwalk(transaction_queue, LARGHOME);
-        Lfree(transaction_queue);
-        apm_unlock_flush();
+static bool apm_flush_queued_transaction(void)
+{
+    apm_lock_flush();
+    Lwalk(transaction_queue, LARGHOME);
+    apm_transaction_t** queued = (apm_transaction_t**)Lcurrent(transaction_queue);
+    apm_unlock_flush();
+
+    if (!queued) {
+        return false;
     }
 
-    //free(metadata);
+    apm_flush_transaction_internal(*queued);
 
-    return NULL;
+    apm_lock_flush();
+    //! Caso o POST para o APM demore demais, a thread principal pode adicionar uma nova transação na queue.
+    //! Neste caso, a posição corrente acaba apontando para esta nova transação. Assim precisamos forçar o retorno para
+    //! a posição 0 da queue.
+    Lwalk(transaction_queue, LARGHOME);
+    Lfree(transaction_queue);
+    apm_unlock_flush();
+
+    return true;
 }
 
 int apm_check_flush_constraints(apm_transaction_t* transaction, apm_config_t* config)
@@ -144,52 +172,106 @@ int apm_check_flush_constraints(apm_transaction_t* transaction, apm_config_t* co
         return 1;
     }
 
-    if (transaction->duration > config->constraints.flush_if_min_duration) {
+    if ((double)transaction->duration_ns / 1000000.0 > config->constraints.flush_if_min_duration) {
         return 1;
     }
 
     return 0;
 }
 
-char* apm_create_payload(apm_transaction_t* transaction)
+int apm_create_payload(apm_transaction_t* transaction, apm_payload_t* payload)
 {
     if (!transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi informada.");
-        return NULL;
+        return -1;
     }
 
-    char* payload = dup_value_or_default(metadata, "");
+    //! a metadata entra na cadeia por referência; sem ela o envio segue, como antes, só com os eventos
+    apm_payload_init(payload);
+
+    //! os eventos são escritos de uma vez, evento a evento, num único buffer que cresce dobrando de tamanho
+    apm_ndjson_t writer;
+    apm_ndjson_init(&writer, APM_NDJSON_INITIAL_SIZE);
 
     if (transaction->error) {
-        apm_dump_error(transaction->error, &payload);
+        apm_dump_error(transaction, transaction->error, &writer);
     }
 
     //! vamos correr todos os spans filhos da transação
     if (transaction->children) {
-        apm_dump_span(transaction->children, &payload, &transaction->span_count);
+        apm_dump_span(transaction, transaction->children, &writer);
     }
 
-    apm_dump_transaction(transaction, &payload);
-    return payload;
+    apm_dump_transaction(transaction, &writer);
+    if (apm_payload_add_events(payload, &writer) != 0) {
+        apm_payload_free(payload);
+        return -1;
+    }
+
+    return 0;
 }
 
 void apm_flush_transaction_internal(apm_transaction_t* transaction)
 {
-    apm_config_t* config = apm_get_config();    
-    char* payload = apm_create_payload(transaction);
+    //! as restrições já foram avaliadas em apm_finish_transaction; tudo o que chega aqui é enviado
+    apm_payload_t payload;
+    if (apm_create_payload(transaction, &payload) == 0) {
+        trrlog(apm_facility, TRRLOG_DEBUG, "Enviando informações para o transaction->id = %s [%s:%d]", transaction->id, __FILE__, __LINE__);
+        apm_create_intake_event_request(&payload);
+        apm_payload_free(&payload);
+    }
+    else {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao montar o payload do transaction->id = %s [%s:%d]", transaction->id, __FILE__, __LINE__);
+    }
+
+    apm_free_transaction(transaction);
+}
 
-    trrlog(apm_facility, TRRLOG_DEBUG, "Enviando informações para o transaction->id = %s [%s:%d]", transaction->id, __FILE__, __LINE__);
+bool apm_finish_transaction(apm_transaction_t* transaction)
+{
+    if (!transaction) {
+        return false;
+    }
 
-    if (apm_check_flush_constraints(transaction, config)) {
-        apm_create_intake_event_request(payload);
+    //! cada contexto capturado segura uma referência. a transação só é decidida e enviada quando a última for
+    //! devolvida, seja aqui no fim da transação, seja em apm_context_release.
+    if (__atomic_sub_fetch(&transaction->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return false;
     }
-    else {
+
+    apm_config_t* config = apm_get_config();
+#ifdef APM_SPAWN_METRICS
+    //! as métricas contam todas as transações, inclusive as que vão ser descartadas logo abaixo
+    if (config && config->breakdown_metrics) {
+        apm_record_breakdown(transaction);
+    }
+    if (config && config->transaction_histograms) {
+        apm_record_histogram(transaction);
+    }
+#endif
+
+    //! a decisão usa apenas campos que já estão na transação. uma transação descartada é liberada aqui mesmo,
+    //! sem passar pela fila nem pelo cJSON.
+    if (transaction->orphaned || !apm_check_flush_constraints(transaction, config)) {
         trrlog(apm_facility, TRRLOG_DEBUG, "Transação descartada");
+        __atomic_add_fetch(&transactions_dropped, 1, __ATOMIC_RELAXED);
+        apm_free_transaction(transaction);
+        return false;
     }
 
-    apm_free_transaction(transaction);
+    __atomic_add_fetch(&transactions_kept, 1, __ATOMIC_RELAXED);
+    apm_enqueue_transaction(transaction);
+    return true;
+}
+
+uint64_t apm_get_transactions_kept(void)
+{
+    return __atomic_load_n(&transactions_kept, __ATOMIC_RELAXED);
+}
 
-    free(payload);
+uint64_t apm_get_transactions_dropped(void)
+{
+    return __atomic_load_n(&transactions_dropped, __ATOMIC_RELAXED);
 }
 
 void apm_lock_flush(void)
@@ -228,3 +310,11 @@ void apm_add_to_flush_queue(void* data, size_t len)
         apm_unlock_flush();
     }
 }
+
+void apm_enqueue_transaction(apm_transaction_t* transaction)
+{
+    //! a fila guarda apenas o ponteiro. a transação (e a sua arena) é liberada pela thread de envio.
+    if (transaction) {
+        apm_add_to_flush_queue(&transaction, sizeof(apm_transaction_t*));
+    }
+}
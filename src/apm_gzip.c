@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+#include <zlib.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_gzip.h>
+
+static int gzip_level = APM_GZIP_DEFAULT_LEVEL;
+
+//! um stream por thread: as threads de envio e de métricas comprimem ao mesmo tempo
+static __thread z_stream* gzip_stream = NULL;
+static __thread int gzip_stream_level = 0;
+
+static z_stream* apm_gzip_stream(void);
+
+
+static z_stream* apm_gzip_stream(void)
+{
+    int level = __atomic_load_n(&gzip_level, __ATOMIC_RELAXED);
+
+    if (gzip_stream) {
+        //! o reset mantém a janela e as tabelas já alocadas; só o nível pode ter mudado desde o último envio
+        deflateReset(gzip_stream);
+        if (gzip_stream_level != level && deflateParams(gzip_stream, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+            gzip_stream_level = level;
+        }
+        return gzip_stream;
+    }
+
+    z_stream* stream = calloc(1, sizeof(z_stream));
+    if (!stream) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória. [%s:%d]", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    //! 15 | 16: janela de 32KB com cabeçalho e trailer gzip
+    if (deflateInit2(stream, level, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao iniciar o compressor gzip [%s:%d]", __FILE__, __LINE__);
+        free(stream);
+        return NULL;
+    }
+
+    gzip_stream = stream;
+    gzip_stream_level = level;
+    return gzip_stream;
+}
+
+void apm_gzip_set_level(int level)
+{
+    if (level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION) {
+        level = APM_GZIP_DEFAULT_LEVEL;
+    }
+
+    __atomic_store_n(&gzip_level, level, __ATOMIC_RELAXED);
+}
+
+int apm_gzip_begin(apm_gzip_t* gzip, const struct iovec* chunks, int count)
+{
+    memset(gzip, 0, sizeof(apm_gzip_t));
+
+    gzip->stream = apm_gzip_stream();
+    if (!gzip->stream) {
+        gzip->failed = true;
+        return -1;
+    }
+
+    //! o deflateReset não mexe na entrada; um envio abortado no meio deixaria next_in apontando para um payload já
+    //! liberado
+    gzip->stream->next_in = NULL;
+    gzip->stream->avail_in = 0;
+    gzip->chunks = chunks;
+    gzip->count = count;
+    return 0;
+}
+
+size_t apm_gzip_read(apm_gzip_t* gzip, char* buffer, size_t size)
+{
+    if (gzip->finished || gzip->failed) {
+        return 0;
+    }
+
+    z_stream* stream = gzip->stream;
+    stream->next_out = (Bytef*)buffer;
+    stream->avail_out = (uInt)size;
+
+    while (stream->avail_out > 0 && !gzip->finished) {
+        //! cada trecho entra no deflate como está; a cadeia nunca é concatenada
+        if (stream->avail_in == 0 && gzip->index < gzip->count) {
+            stream->next_in = (Bytef*)gzip->chunks[gzip->index].iov_base;
+            stream->avail_in = (uInt)gzip->chunks[gzip->index].iov_len;
+            gzip->index++;
+        }
+
+        //! depois que o último trecho entrou, todas as chamadas seguem com Z_FINISH até o fim do stream
+        int ret = deflate(stream, gzip->index == gzip->count ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            gzip->finished = true;
+        }
+        else if (ret == Z_STREAM_ERROR) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao comprimir o payload [%s:%d]", __FILE__, __LINE__);
+            gzip->failed = true;
+            break;
+        }
+    }
+
+    return size - stream->avail_out;
+}
+
+void apm_gzip_clear(void)
+{
+    if (gzip_stream) {
+        deflateEnd(gzip_stream);
+        free(gzip_stream);
+        gzip_stream = NULL;
+    }
+}
@@ -0,0 +1,363 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_histogram.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+
+//! a junção dos shards pode ter mais séries do que um shard sozinho
+#define APM_HISTOGRAM_MERGED_SLOTS (APM_HISTOGRAM_SLOTS * 2)
+
+typedef struct {
+    uint32_t hash;
+    char* name;
+    char* type;
+    char* outcome;
+    uint32_t counts[APM_HISTOGRAM_BUCKETS];
+} apm_histogram_series_t;
+
+typedef struct {
+    const apm_histogram_series_t* key;
+    uint64_t total;
+    uint64_t counts[APM_HISTOGRAM_BUCKETS];
+} apm_histogram_merged_t;
+
+typedef struct apm_histogram_shard apm_histogram_shard_t;
+struct apm_histogram_shard {
+    int in_use;                 //!< 1 enquanto a thread dona estiver viva; depois o shard pode ser reaproveitado
+    int series_count;           //!< só a thread dona lê e escreve
+    apm_histogram_shard_t* next;
+    apm_histogram_series_t* slots[APM_HISTOGRAM_SLOTS];
+};
+
+//! lista de todos os shards já criados. só cresce; os shards de threads que terminaram são reaproveitados.
+static apm_histogram_shard_t* shard_list = NULL;
+static int shard_generation = 0;
+
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+
+static __thread apm_histogram_shard_t* current_shard = NULL;
+static __thread int current_generation = -1;
+
+//! avisa só uma vez quando uma série fica de fora do envio
+static bool merge_full_logged = false;
+
+static void apm_histogram_key_create(void);
+static void apm_histogram_thread_exit(void* data);
+static apm_histogram_shard_t* apm_histogram_shard(void);
+static uint32_t apm_histogram_hash(const char** keys);
+static apm_histogram_series_t* apm_histogram_series(apm_histogram_shard_t* shard, const char** keys);
+static int apm_histogram_bucket(uint64_t us);
+static double apm_histogram_value(int bucket);
+static bool apm_histogram_has_counts(apm_histogram_series_t* series);
+static void apm_histogram_to_ndjson(apm_histogram_merged_t* merged, uint64_t timestamp, apm_ndjson_t* writer);
+
+
+static void apm_histogram_key_create(void)
+{
+    pthread_key_create(&shard_key, apm_histogram_thread_exit);
+}
+
+static void apm_histogram_thread_exit(void* data)
+{
+    //! as contagens que ficaram no shard ainda serão enviadas; a próxima thread nova herda o shard. se a lista foi
+    //! esvaziada por apm_histogram_clear depois que a thread pegou o shard, ele já foi liberado.
+    apm_histogram_shard_t* shard = data;
+    if (current_generation == __atomic_load_n(&shard_generation, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&shard->in_use, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static apm_histogram_shard_t* apm_histogram_shard(void)
+{
+    int generation = __atomic_load_n(&shard_generation, __ATOMIC_ACQUIRE);
+    if (current_shard && current_generation == generation) {
+        return current_shard;
+    }
+
+    pthread_once(&shard_key_once, apm_histogram_key_create);
+
+    apm_histogram_shard_t* shard = __atomic_load_n(&shard_list, __ATOMIC_ACQUIRE);
+    for (; shard; shard = shard->next) {
+        int in_use = 0;
+        if (__atomic_compare_exchange_n(&shard->in_use, &in_use, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!shard) {
+        shard = calloc(1, sizeof(apm_histogram_shard_t));
+        if (!shard) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return NULL;
+        }
+
+        shard->in_use = 1;
+        shard->next = __atomic_load_n(&shard_list, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&shard_list, &shard->next, shard, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    pthread_setspecific(shard_key, shard);
+    current_shard = shard;
+    current_generation = generation;
+    return shard;
+}
+
+static uint32_t apm_histogram_hash(const char** keys)
+{
+    //! fnv-1a sobre as três chaves, com um separador que não aparece em texto
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 3; i++) {
+        for (const unsigned char* p = (const unsigned char*)keys[i]; *p; p++) {
+            hash ^= *p;
+            hash *= 16777619u;
+        }
+        hash ^= 0xff;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static apm_histogram_series_t* apm_histogram_series(apm_histogram_shard_t* shard, const char** keys)
+{
+    uint32_t hash = apm_histogram_hash(keys);
+
+    for (uint32_t i = 0; i < APM_HISTOGRAM_SLOTS; i++) {
+        apm_histogram_series_t** slot = &shard->slots[(hash + i) & (APM_HISTOGRAM_SLOTS - 1)];
+        apm_histogram_series_t* series = *slot;
+
+        if (series) {
+            if (series->hash == hash && strcmp(series->name, keys[0]) == 0 && strcmp(series->type, keys[1]) == 0
+                && strcmp(series->outcome, keys[2]) == 0) {
+                return series;
+            }
+            continue;
+        }
+
+        if (shard->series_count >= APM_HISTOGRAM_MAX_SERIES) {
+            return NULL;
+        }
+
+        size_t len[3];
+        size_t total = 0;
+        for (int k = 0; k < 3; k++) {
+            len[k] = strlen(keys[k]) + 1;
+            total += len[k];
+        }
+
+        series = calloc(1, sizeof(apm_histogram_series_t) + total);
+        if (!series) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+            return NULL;
+        }
+
+        char* cursor = (char*)(series + 1);
+        char** fields[3] = { &series->name, &series->type, &series->outcome };
+        for (int k = 0; k < 3; k++) {
+            memcpy(cursor, keys[k], len[k]);
+            *fields[k] = cursor;
+            cursor += len[k];
+        }
+        series->hash = hash;
+
+        //! a thread de métricas percorre os slots enquanto a dona insere: a série só aparece já preenchida
+        __atomic_store_n(slot, series, __ATOMIC_RELEASE);
+        shard->series_count++;
+        return series;
+    }
+
+    return NULL;
+}
+
+static int apm_histogram_bucket(uint64_t us)
+{
+    //! log-linear: valores pequenos são exatos; a partir daí cada potência de 2 tem APM_HISTOGRAM_SUB_BUCKETS faixas
+    if (us < APM_HISTOGRAM_SUB_BUCKETS) {
+        return (int)us;
+    }
+
+    int shift = 63 - __builtin_clzll(us) - APM_HISTOGRAM_SUB_BITS;
+    int bucket = (shift + 1) * APM_HISTOGRAM_SUB_BUCKETS + (int)((us >> shift) - APM_HISTOGRAM_SUB_BUCKETS);
+    return bucket < APM_HISTOGRAM_BUCKETS ? bucket : APM_HISTOGRAM_BUCKETS - 1;
+}
+
+static double apm_histogram_value(int bucket)
+{
+    //! o valor enviado é o meio da faixa
+    if (bucket < APM_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = bucket / APM_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(APM_HISTOGRAM_SUB_BUCKETS + bucket % APM_HISTOGRAM_SUB_BUCKETS) << shift;
+    return (double)lower + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+void apm_record_histogram(apm_transaction_t* transaction)
+{
+    if (!transaction) {
+        return;
+    }
+
+    apm_histogram_shard_t* shard = apm_histogram_shard();
+    if (!shard) {
+        return;
+    }
+
+    const char* keys[3] = {
+        transaction->name ? transaction->name : "",
+        transaction->type ? transaction->type : "",
+        transaction->outcome ? transaction->outcome : ""
+    };
+    apm_histogram_series_t* series = apm_histogram_series(shard, keys);
+    if (series) {
+        //! só a dona incrementa; o atômico existe para não perder contagens quando a thread de métricas zera
+        __atomic_add_fetch(&series->counts[apm_histogram_bucket(transaction->duration_ns / 1000)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static bool apm_histogram_has_counts(apm_histogram_series_t* series)
+{
+    //! séries paradas não ocupam lugar na junção, senão as adiadas nunca entrariam
+    for (int b = 0; b < APM_HISTOGRAM_BUCKETS; b++) {
+        if (__atomic_load_n(&series->counts[b], __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void apm_histogram_to_ndjson(apm_histogram_merged_t* merged, uint64_t timestamp, apm_ndjson_t* writer)
+{
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("metricset"));
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), timestamp);
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("name"), merged->key->name);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), merged->key->type);
+    apm_ndjson_end_object(writer);
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("tags"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("outcome"), merged->key->outcome);
+    apm_ndjson_end_object(writer);
+
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("samples"));
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("transaction.duration.histogram"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), "histogram");
+
+    //! só os buckets com contagem entram; values e counts saem em duas passadas sobre o mesmo vetor
+    apm_ndjson_begin_array(writer, APM_NDJSON_KEY("values"));
+    for (int i = 0; i < APM_HISTOGRAM_BUCKETS; i++) {
+        if (merged->counts[i]) {
+            apm_ndjson_number(writer, NULL, 0, apm_histogram_value(i));
+        }
+    }
+    apm_ndjson_end_array(writer);
+
+    apm_ndjson_begin_array(writer, APM_NDJSON_KEY("counts"));
+    for (int i = 0; i < APM_HISTOGRAM_BUCKETS; i++) {
+        if (merged->counts[i]) {
+            apm_ndjson_uint64(writer, NULL, 0, merged->counts[i]);
+        }
+    }
+    apm_ndjson_end_array(writer);
+
+    apm_ndjson_end_object(writer);
+    apm_ndjson_end_object(writer);
+    apm_ndjson_end_event(writer);
+}
+
+void apm_dump_histograms(uint64_t timestamp, apm_ndjson_t* writer)
+{
+    apm_histogram_merged_t** merged = calloc(APM_HISTOGRAM_MERGED_SLOTS, sizeof(apm_histogram_merged_t*));
+    if (!merged) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+        return;
+    }
+
+    //! cada contador é zerado com uma troca atômica, então um incremento concorrente cai neste intervalo ou no
+    //! próximo, nunca se perde
+    for (apm_histogram_shard_t* shard = __atomic_load_n(&shard_list, __ATOMIC_ACQUIRE); shard; shard = shard->next) {
+        for (int i = 0; i < APM_HISTOGRAM_SLOTS; i++) {
+            apm_histogram_series_t* series = __atomic_load_n(&shard->slots[i], __ATOMIC_ACQUIRE);
+            if (!series || !apm_histogram_has_counts(series)) {
+                continue;
+            }
+
+            apm_histogram_merged_t* target = NULL;
+            for (uint32_t j = 0; j < APM_HISTOGRAM_MERGED_SLOTS; j++) {
+                apm_histogram_merged_t** slot = &merged[(series->hash + j) & (APM_HISTOGRAM_MERGED_SLOTS - 1)];
+                if (!*slot) {
+                    *slot = calloc(1, sizeof(apm_histogram_merged_t));
+                    if (*slot) {
+                        (*slot)->key = series;
+                    }
+                    target = *slot;
+                    break;
+                }
+
+                const apm_histogram_series_t* key = (*slot)->key;
+                if (key->hash == series->hash && strcmp(key->name, series->name) == 0
+                    && strcmp(key->type, series->type) == 0 && strcmp(key->outcome, series->outcome) == 0) {
+                    target = *slot;
+                    break;
+                }
+            }
+
+            //! sem lugar na junção as contagens ficam no shard e a série tenta de novo no próximo intervalo
+            if (!target) {
+                if (!__atomic_exchange_n(&merge_full_logged, true, __ATOMIC_RELAXED)) {
+                    trrlog(apm_facility, TRRLOG_ERR, "Histograma sem espaço para a série %s; contagens adiadas.", series->name);
+                }
+                continue;
+            }
+
+            for (int b = 0; b < APM_HISTOGRAM_BUCKETS; b++) {
+                if (__atomic_load_n(&series->counts[b], __ATOMIC_RELAXED)) {
+                    uint32_t count = __atomic_exchange_n(&series->counts[b], 0, __ATOMIC_RELAXED);
+                    target->counts[b] += count;
+                    target->total += count;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < APM_HISTOGRAM_MERGED_SLOTS; i++) {
+        if (!merged[i]) {
+            continue;
+        }
+
+        if (merged[i]->total && writer) {
+            apm_histogram_to_ndjson(merged[i], timestamp, writer);
+        }
+
+        free(merged[i]);
+    }
+
+    free(merged);
+}
+
+void apm_histogram_clear(void)
+{
+    //! só pode ser chamada quando nenhuma transação estiver terminando. as threads vivas percebem a troca de
+    //! geração e pedem um shard novo.
+    apm_histogram_shard_t* shard = __atomic_exchange_n(&shard_list, NULL, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&shard_generation, 1, __ATOMIC_RELEASE);
+
+    while (shard) {
+        apm_histogram_shard_t* next = shard->next;
+        for (int i = 0; i < APM_HISTOGRAM_SLOTS; i++) {
+            free(shard->slots[i]);
+        }
+        free(shard);
+        shard = next;
+    }
+}
@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+#include <trrapm/apm_intern.h>
+
+static char* intern_table[APM_INTERN_SLOTS];
+static int intern_entries = 0;
+
+static uint32_t apm_intern_hash(const char* str, size_t* len);
+
+
+static uint32_t apm_intern_hash(const char* str, size_t* len)
+{
+    //! fnv-1a
+    uint32_t hash = 2166136261u;
+    const unsigned char* p = (const unsigned char*)str;
+    for (; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+
+    *len = (size_t)(p - (const unsigned char*)str);
+    return hash;
+}
+
+const char* apm_intern(const char* str)
+{
+    size_t len = 0;
+    char* copy = NULL;
+
+    if (!str) {
+        return NULL;
+    }
+
+    uint32_t hash = apm_intern_hash(str, &len);
+    if (len > APM_INTERN_MAX_LEN) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < APM_INTERN_SLOTS; i++) {
+        char** slot = &intern_table[(hash + i) & (APM_INTERN_SLOTS - 1)];
+        char* entry = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        if (!entry) {
+            //! posição livre. só tentamos inserir se ainda houver espaço, senão a sondagem ficaria longa demais.
+            if (__atomic_load_n(&intern_entries, __ATOMIC_RELAXED) >= APM_INTERN_MAX_ENTRIES) {
+                free(copy);
+                return NULL;
+            }
+
+            if (!copy) {
+                copy = malloc(len + 1);
+                if (!copy) {
+                    trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+                    return NULL;
+                }
+                memcpy(copy, str, len + 1);
+            }
+
+            if (__atomic_compare_exchange_n(slot, &entry, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_add_fetch(&intern_entries, 1, __ATOMIC_RELAXED);
+                return copy;
+            }
+
+            //! outra thread ocupou a posição antes; entry agora tem o valor dela
+        }
+
+        if (strcmp(entry, str) == 0) {
+            free(copy);
+            return entry;
+        }
+    }
+
+    free(copy);
+    return NULL;
+}
+
+const char* apm_intern_value_or_default(apm_arena_t* arena, const char* value, const char* def)
+{
+    const char* str = value ? value : (def ? def : "");
+    const char* interned = apm_intern(str);
+    if (interned) {
+        return interned;
+    }
+
+    return apm_arena_strdup(arena, str);
+}
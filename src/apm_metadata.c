@@ -1,4 +1,5 @@
 #include <gnu/libc-version.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,8 +9,25 @@
 
 #include <trrapm/apm.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_payload.h>
 #include <trrapm/cJSON.h>
 
+static pthread_mutex_t metadata_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t metadata_atfork_once = PTHREAD_ONCE_INIT;
+//! a metadata montada fica guardada para que o fork só precise atualizar o processo, sem consultar a nuvem de novo
+static apm_metadata_t* metadata_cache = NULL;
+static apm_metadata_line_t* metadata_line = NULL;
+//! marcado no filho de um fork: a linha corrente tem o pid do pai
+static int metadata_stale = 0;
+
+static void apm_metadata_atfork_register(void);
+static void apm_metadata_atfork_lock(void);
+static void apm_metadata_atfork_unlock(void);
+static void apm_metadata_atfork_child(void);
+static apm_metadata_line_t* apm_render_metadata_line(apm_metadata_t* metadata);
+static apm_metadata_line_t* apm_metadata_acquire_unlocked(void);
+
+
 apm_metadata_t* apm_new_metadata(void)
 {
     apm_metadata_t* metadata = calloc(1, sizeof(apm_metadata_t));
@@ -137,22 +155,142 @@ void apm_free_cloud(apm_cloud_t* cloud)
     free(cloud);
 }
 
-void apm_dump_metadata(apm_metadata_t* metadata, char** buffer)
+static void apm_metadata_atfork_register(void)
 {
-    //! vamos converter para json
-    char* partial_buffer = apm_metadata_to_json(metadata);
+    pthread_atfork(apm_metadata_atfork_lock, apm_metadata_atfork_unlock, apm_metadata_atfork_child);
+}
+
+static void apm_metadata_atfork_lock(void)
+{
+    //! o filho não pode herdar o mutex travado por uma thread que não existe mais nele
+    pthread_mutex_lock(&metadata_mutex);
+}
+
+static void apm_metadata_atfork_unlock(void)
+{
+    pthread_mutex_unlock(&metadata_mutex);
+}
+
+static void apm_metadata_atfork_child(void)
+{
+    metadata_stale = 1;
+    pthread_mutex_unlock(&metadata_mutex);
+}
+
+static apm_metadata_line_t* apm_render_metadata_line(apm_metadata_t* metadata)
+{
+    apm_metadata_line_t* line = NULL;
+    char* json = apm_metadata_to_json(metadata);
+    if (!json) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao serializar a metadata [%s:%d]", __FILE__, __LINE__);
+        goto finally;
+    }
+
+    size_t len = strlen(json);
+    line = malloc(sizeof(apm_metadata_line_t) + len + 2);
+    if (!line) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória. [%s:%d]", __FILE__, __LINE__);
+        goto finally;
+    }
+
+    line->refs = 1;
+    line->pid = metadata->process->pid;
+    line->len = len + 1;
+    memcpy(line->data, json, len);
+    line->data[len] = '\n';
+    line->data[len + 1] = '\0';
+
+finally:
+    free(json);
+    return line;
+}
+
+apm_metadata_line_t* apm_metadata_acquire(void)
+{
+    apm_metadata_line_t* line = NULL;
+    apm_metadata_line_t* rendered = NULL;
+
+    pthread_once(&metadata_atfork_once, apm_metadata_atfork_register);
+
+    //! o sinal de crash pode ter chegado com o mutex na mão desta mesma thread (dentro do acquire, do release da
+    //! linha antiga ou dos handlers de fork): lá ele é só tentado
+    if (apm_in_crash_handler()) {
+        if (pthread_mutex_trylock(&metadata_mutex) != 0) {
+            return apm_metadata_acquire_unlocked();
+        }
+    }
+    else {
+        pthread_mutex_lock(&metadata_mutex);
+    }
+    //! o caminho comum não faz syscall: só um fork (visto pelo handler do filho) invalida a linha
+    if (metadata_line && !metadata_stale) {
+        goto finally;
+    }
 
-    if (*buffer == NULL) {
-        *buffer = calloc(1, strlen(partial_buffer) + 2);
-    } else {
-        *buffer = realloc(*buffer, strlen(*buffer) + strlen(partial_buffer) + 2);
+    if (!metadata_cache) {
+        apm_metadata_t* metadata = apm_new_metadata();
+        if (!metadata) {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar estrutura de metadata [%s:%d]", __FILE__, __LINE__);
+            goto finally;
+        }
+        //! publicada já completa: o handler de crash pode lê-la sem o mutex
+        __atomic_store_n(&metadata_cache, metadata, __ATOMIC_RELEASE);
+    }
+    else {
+        //! depois de um fork, service, system e cloud continuam os mesmos; só o processo muda
+        metadata_cache->process->pid = getpid();
+        metadata_cache->process->ppid = getppid();
+    }
+
+    //! se a nova renderização falhar, a linha anterior continua valendo
+    rendered = apm_render_metadata_line(metadata_cache);
+    if (!rendered) {
+        goto finally;
     }
 
-    strcat(*buffer, partial_buffer);
-    strcat(*buffer, "\n");
+    apm_metadata_release(metadata_line);
+    metadata_line = rendered;
+    metadata_stale = 0;
+
+finally:
+    line = metadata_line;
+    if (line) {
+        __atomic_add_fetch(&line->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&metadata_mutex);
+    return line;
+}
 
-    apm_free_metadata(metadata);
-    free(partial_buffer);
+static apm_metadata_line_t* apm_metadata_acquire_unlocked(void)
+{
+    //! sem o mutex, a linha compartilhada pode estar sendo trocada; uma linha própria é renderizada a partir da
+    //! metadata guardada, que só é criada uma vez. sem ela, o payload do crash segue só com os eventos.
+    apm_metadata_t* metadata = __atomic_load_n(&metadata_cache, __ATOMIC_ACQUIRE);
+    if (!metadata) {
+        trrlog(apm_facility, TRRLOG_ERR, "Metadata ocupada durante o crash [%s:%d]", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    return apm_render_metadata_line(metadata);
+}
+
+void apm_metadata_release(apm_metadata_line_t* line)
+{
+    if (line && __atomic_sub_fetch(&line->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(line);
+    }
+}
+
+void apm_metadata_clear(void)
+{
+    pthread_mutex_lock(&metadata_mutex);
+    apm_metadata_release(metadata_line);
+    metadata_line = NULL;
+    if (metadata_cache) {
+        apm_free_metadata(metadata_cache);
+        metadata_cache = NULL;
+    }
+    pthread_mutex_unlock(&metadata_mutex);
 }
 
 char* apm_metadata_to_json(apm_metadata_t* metadata)
@@ -6,7 +6,12 @@
 #include <trrutil/ndtlist.h>
 
 #include <trrapm/apm.h>
+#include <trrapm/apm_breakdown.h>
+#include <trrapm/apm_gzip.h>
+#include <trrapm/apm_histogram.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+#include <trrapm/apm_payload.h>
 #include <trrapm/apm_rest.h>
 
 static pthread_t threadh;
@@ -66,20 +71,14 @@ void apm_destroy_metrics(void)
 
         pthread_cond_destroy(&condh);
         pthread_mutex_destroy(&mutexh);
+
+        apm_breakdown_clear();
+        apm_histogram_clear();
     }
 }
 
 static void* apm_metrics_thread(void* arg)
 {
-    apm_metadata_t* metadatat = apm_new_metadata();
-    if (metadatat == NULL) {
-        trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar estrutura de metadata");
-        return NULL;
-    }
-
-    char* metadata = NULL;
-    apm_dump_metadata(metadatat, &metadata);
-
     apm_stats_t* old_stats = apm_collect_metrics();
 
     while (1) {
@@ -96,7 +95,12 @@ static void* apm_metrics_thread(void* arg)
 
         trrlog(apm_facility, TRRLOG_DEBUG, "Enviando métricas");
 
-        char* payload = strdup(metadata);
+        //! a linha de metadata é compartilhada com a thread de envio; aqui só ganha uma referência
+        apm_payload_t payload;
+        apm_payload_init(&payload);
+
+        apm_ndjson_t writer;
+        apm_ndjson_init(&writer, APM_NDJSON_INITIAL_SIZE);
 
         apm_stats_t* new_stats = apm_collect_metrics();
 
@@ -107,19 +111,26 @@ static void* apm_metrics_thread(void* arg)
         trrlog(apm_facility, TRRLOG_DEBUG, "stats->process->vsize=%f", new_stats->process->vsize);
         trrlog(apm_facility, TRRLOG_DEBUG, "stats->process->rss=%f", new_stats->process->rss);
 
-        apm_dump_metrics(new_stats, old_stats, &payload);
+        apm_dump_metrics(new_stats, old_stats, &writer);
+        apm_dump_breakdown(new_stats->timestamp, &writer);
+        apm_dump_histograms(new_stats->timestamp, &writer);
 
-        trrlog(apm_facility, TRRLOG_DEBUG, "%s", payload);
-        apm_create_intake_event_request(payload);
+        if (apm_payload_add_events(&payload, &writer) == 0) {
+            trrlog(apm_facility, TRRLOG_DEBUG, "%.*s", (int)payload.chunks[payload.count - 1].iov_len, (const char*)payload.chunks[payload.count - 1].iov_base);
+            apm_create_intake_event_request(&payload);
+        }
+        else {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao montar o payload de métricas [%s:%d]", __FILE__, __LINE__);
+        }
 
         apm_free_metrics(old_stats);
         old_stats = new_stats;
 
-        free(payload);
+        apm_payload_free(&payload);
     }
 
-    free(metadata);
     apm_free_metrics(old_stats);
+    apm_gzip_clear();
 
     return NULL;
 }
@@ -148,7 +159,7 @@ void apm_free_metrics(apm_stats_t* stats)
     free(stats);
 }
 
-void apm_dump_metrics(apm_stats_t* new, apm_stats_t* old, char** buffer)
+void apm_dump_metrics(apm_stats_t* new, apm_stats_t* old, apm_ndjson_t* writer)
 {
     apm_process_stats_t currp = {
         .stime = new->process->stime,
@@ -169,14 +180,7 @@ void apm_dump_metrics(apm_stats_t* new, apm_stats_t* old, char** buffer)
         .timestamp = new->timestamp
     };
 
-    //! vamos converter para json
-    char* partial_buffer = apm_stats_to_json(&curr);
-
-    *buffer = realloc(*buffer, strlen(*buffer) + strlen(partial_buffer) + 2);
-    strcat(*buffer, partial_buffer);
-    strcat(*buffer, "\n");
-
-    free(partial_buffer);
+    apm_stats_to_ndjson(&curr, writer);
 }
 
 void apm_lock_metrics(void)
@@ -0,0 +1,262 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_escape.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+
+static bool apm_ndjson_reserve(apm_ndjson_t* writer, size_t len);
+static void apm_ndjson_append(apm_ndjson_t* writer, const char* data, size_t len);
+static void apm_ndjson_put(apm_ndjson_t* writer, char c);
+static void apm_ndjson_field(apm_ndjson_t* writer, const char* key, size_t key_len);
+static void apm_ndjson_escaped(apm_ndjson_t* writer, const char* value);
+
+
+static bool apm_ndjson_reserve(apm_ndjson_t* writer, size_t len)
+{
+    if (writer->failed) {
+        return false;
+    }
+
+    //! sempre sobra um byte para o '\0' de apm_ndjson_detach
+    if (writer->len + len + 1 <= writer->size) {
+        return true;
+    }
+
+    size_t size = writer->size ? writer->size : APM_NDJSON_INITIAL_SIZE;
+    while (size < writer->len + len + 1) {
+        size *= 2;
+    }
+
+    char* tmp = realloc(writer->data, size);
+    if (!tmp) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória. [%s:%d]", __FILE__, __LINE__);
+        writer->failed = true;
+        return false;
+    }
+
+    writer->data = tmp;
+    writer->size = size;
+    return true;
+}
+
+static void apm_ndjson_append(apm_ndjson_t* writer, const char* data, size_t len)
+{
+    if (apm_ndjson_reserve(writer, len)) {
+        memcpy(writer->data + writer->len, data, len);
+        writer->len += len;
+    }
+}
+
+static void apm_ndjson_put(apm_ndjson_t* writer, char c)
+{
+    if (apm_ndjson_reserve(writer, 1)) {
+        writer->data[writer->len++] = c;
+    }
+}
+
+static void apm_ndjson_field(apm_ndjson_t* writer, const char* key, size_t key_len)
+{
+    if (writer->comma) {
+        apm_ndjson_put(writer, ',');
+    }
+    if (key) {
+        apm_ndjson_append(writer, key, key_len);
+    }
+    writer->comma = true;
+}
+
+static void apm_ndjson_escaped(apm_ndjson_t* writer, const char* value)
+{
+    //! mesmo escape do print_string_ptr do cJSON; os trechos sem escape são achados pela varredura vetorial e
+    //! copiados de uma vez
+    const unsigned char* p = (const unsigned char*)value;
+
+    apm_ndjson_put(writer, '"');
+    for (;; p++) {
+        const unsigned char* run = p;
+        p = (const unsigned char*)apm_escape_scan((const char*)run);
+
+        apm_ndjson_append(writer, (const char*)run, (size_t)(p - run));
+        if (*p == '\0') {
+            break;
+        }
+
+        char escaped[8];
+        switch (*p) {
+        case '"':  apm_ndjson_append(writer, "\\\"", 2); break;
+        case '\\': apm_ndjson_append(writer, "\\\\", 2); break;
+        case '\b': apm_ndjson_append(writer, "\\b", 2); break;
+        case '\f': apm_ndjson_append(writer, "\\f", 2); break;
+        case '\n': apm_ndjson_append(writer, "\\n", 2); break;
+        case '\r': apm_ndjson_append(writer, "\\r", 2); break;
+        case '\t': apm_ndjson_append(writer, "\\t", 2); break;
+        default:
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+            apm_ndjson_append(writer, escaped, 6);
+            break;
+        }
+    }
+    apm_ndjson_put(writer, '"');
+}
+
+int apm_ndjson_init(apm_ndjson_t* writer, size_t size)
+{
+    memset(writer, 0, sizeof(apm_ndjson_t));
+    if (!size) {
+        return 0;
+    }
+
+    writer->data = malloc(size);
+    if (!writer->data) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória. [%s:%d]", __FILE__, __LINE__);
+        writer->failed = true;
+        return -1;
+    }
+
+    writer->size = size;
+    return 0;
+}
+
+void apm_ndjson_free(apm_ndjson_t* writer)
+{
+    free(writer->data);
+    memset(writer, 0, sizeof(apm_ndjson_t));
+}
+
+char* apm_ndjson_detach(apm_ndjson_t* writer)
+{
+    char* payload = NULL;
+    if (!writer->failed && apm_ndjson_reserve(writer, 0)) {
+        writer->data[writer->len] = '\0';
+        payload = writer->data;
+        writer->data = NULL;
+    }
+
+    apm_ndjson_free(writer);
+    return payload;
+}
+
+void apm_ndjson_raw(apm_ndjson_t* writer, const char* data, size_t len)
+{
+    apm_ndjson_append(writer, data, len);
+}
+
+void apm_ndjson_begin_event(apm_ndjson_t* writer, const char* key, size_t key_len)
+{
+    apm_ndjson_put(writer, '{');
+    apm_ndjson_append(writer, key, key_len);
+    apm_ndjson_put(writer, '{');
+    writer->comma = false;
+}
+
+void apm_ndjson_end_event(apm_ndjson_t* writer)
+{
+    apm_ndjson_append(writer, "}}\n", 3);
+    writer->comma = false;
+}
+
+void apm_ndjson_begin_object(apm_ndjson_t* writer, const char* key, size_t key_len)
+{
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_put(writer, '{');
+    writer->comma = false;
+}
+
+void apm_ndjson_end_object(apm_ndjson_t* writer)
+{
+    apm_ndjson_put(writer, '}');
+    writer->comma = true;
+}
+
+void apm_ndjson_begin_array(apm_ndjson_t* writer, const char* key, size_t key_len)
+{
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_put(writer, '[');
+    writer->comma = false;
+}
+
+void apm_ndjson_end_array(apm_ndjson_t* writer)
+{
+    apm_ndjson_put(writer, ']');
+    writer->comma = true;
+}
+
+void apm_ndjson_key(apm_ndjson_t* writer, const char* name)
+{
+    apm_ndjson_field(writer, NULL, 0);
+    apm_ndjson_escaped(writer, name);
+    apm_ndjson_put(writer, ':');
+    writer->comma = false;
+}
+
+void apm_ndjson_string(apm_ndjson_t* writer, const char* key, size_t key_len, const char* value)
+{
+    if (!value) {
+        return;
+    }
+
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_escaped(writer, value);
+}
+
+void apm_ndjson_number(apm_ndjson_t* writer, const char* key, size_t key_len, double value)
+{
+    char number[32];
+    int len = 0;
+
+    //! mesmo formato do print_number do cJSON, para o intake receber exatamente o que recebia antes
+    if (value != value || value - value != 0) {
+        len = snprintf(number, sizeof(number), "null");
+    }
+    else if (value >= INT32_MIN && value <= INT32_MAX && value == (double)(int)value) {
+        len = snprintf(number, sizeof(number), "%d", (int)value);
+    }
+    else {
+        len = snprintf(number, sizeof(number), "%1.17g", value);
+        //! o separador decimal do locale não pode vazar para o json
+        for (int i = 0; i < len; i++) {
+            if (number[i] == ',') {
+                number[i] = '.';
+            }
+        }
+    }
+
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_append(writer, number, (size_t)len);
+}
+
+void apm_ndjson_uint64(apm_ndjson_t* writer, const char* key, size_t key_len, uint64_t value)
+{
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%" PRIu64, value);
+
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_append(writer, number, (size_t)len);
+}
+
+void apm_ndjson_int64(apm_ndjson_t* writer, const char* key, size_t key_len, int64_t value)
+{
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%" PRId64, value);
+
+    apm_ndjson_field(writer, key, key_len);
+    apm_ndjson_append(writer, number, (size_t)len);
+}
+
+void apm_ndjson_bool(apm_ndjson_t* writer, const char* key, size_t key_len, bool value)
+{
+    apm_ndjson_field(writer, key, key_len);
+    if (value) {
+        apm_ndjson_append(writer, "true", 4);
+    }
+    else {
+        apm_ndjson_append(writer, "false", 5);
+    }
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include <trrlog1/trrlog.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_ndjson.h>
+#include <trrapm/apm_payload.h>
+
+int apm_payload_init(apm_payload_t* payload)
+{
+    memset(payload, 0, sizeof(apm_payload_t));
+
+    payload->metadata = apm_metadata_acquire();
+    if (!payload->metadata) {
+        trrlog(apm_facility, TRRLOG_ERR, "Metadata indisponível para o payload [%s:%d]", __FILE__, __LINE__);
+        return -1;
+    }
+
+    //! o trecho aponta para a linha compartilhada; ela é imutável, então não há cópia
+    payload->chunks[0].iov_base = payload->metadata->data;
+    payload->chunks[0].iov_len = payload->metadata->len;
+    payload->count = 1;
+    payload->len = payload->metadata->len;
+    return 0;
+}
+
+int apm_payload_add_events(apm_payload_t* payload, apm_ndjson_t* writer)
+{
+    if (payload->count == APM_PAYLOAD_MAX_CHUNKS) {
+        trrlog(apm_facility, TRRLOG_ERR, "Payload sem espaço para mais trechos [%s:%d]", __FILE__, __LINE__);
+        apm_ndjson_free(writer);
+        return -1;
+    }
+
+    //! o tamanho precisa ser lido antes do detach, que zera o escritor
+    size_t len = writer->len;
+    char* events = apm_ndjson_detach(writer);
+    if (!events) {
+        return -1;
+    }
+
+    payload->chunks[payload->count].iov_base = events;
+    payload->chunks[payload->count].iov_len = len;
+    payload->count++;
+    payload->len += len;
+    return 0;
+}
+
+void apm_payload_free(apm_payload_t* payload)
+{
+    //! o primeiro trecho é da metadata, que só perde uma referência; os demais são buffers de eventos
+    for (int i = payload->metadata ? 1 : 0; i < payload->count; i++) {
+        free(payload->chunks[i].iov_base);
+    }
+
+    apm_metadata_release(payload->metadata);
+    memset(payload, 0, sizeof(apm_payload_t));
+}
@@ -12,11 +12,12 @@ Copyright (C) 2024 Terra Networks Brasil S.A.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <trrlog1/trrlog.h>
 #include <trrutil3/base64.h>
-#include <zlib.h>
 
 #include <trrapm/apm.h>
+#include <trrapm/apm_gzip.h>
 #include <trrapm/apm_rest.h>
 
 // Buffer para a payload de resposta
@@ -25,13 +26,19 @@ typedef struct {
     size_t size; //!< Quantidade de caracteres dos dados
 } Payload;
 
+// Cursor sobre a cadeia de trechos do corpo, consumida pelo callback de leitura da libcurl
+typedef struct {
+    const struct iovec* chunks; //!< Trechos do corpo, na ordem de envio
+    int count; //!< Quantidade de trechos
+    int index; //!< Trecho corrente
+    size_t offset; //!< Bytes já enviados do trecho corrente
+} Body;
+
 // Estrutura que guarda a lista de cabeçalhos
 struct headers {
     struct curl_slist* list;
 };
 
-static char* gzip_compress(const char* input, size_t input_size, size_t* output_size);
-
 extern CURLcode (*curl_easy_perform_s)(CURL*);
 extern CURLcode (*curl_easy_setopt_s)(CURL*, CURLoption, ...);
 extern void (*curl_easy_cleanup_s)(CURL*);
@@ -82,6 +89,41 @@ static size_t request_callback(void* ptr, size_t size, size_t nmemb, void* data)
     return realsize;
 }
 
+// Callback que entrega à libcurl os trechos do corpo, em sequência, sem concatená-los antes
+static size_t read_callback(char* buffer, size_t size, size_t nitems, void* data)
+{
+    size_t room = size * nitems;
+    size_t written = 0;
+    Body* body = data;
+
+    while (written < room && body->index < body->count) {
+        const struct iovec* chunk = &body->chunks[body->index];
+        size_t left = chunk->iov_len - body->offset;
+        size_t len = left < room - written ? left : room - written;
+
+        memcpy(buffer + written, (const char*)chunk->iov_base + body->offset, len);
+        written += len;
+        body->offset += len;
+        if (body->offset == chunk->iov_len) {
+            body->index++;
+            body->offset = 0;
+        }
+    }
+    return written;
+}
+
+// Callback que entrega à libcurl o corpo comprimido, produzido sob demanda direto no buffer de upload
+static size_t gzip_read_callback(char* buffer, size_t size, size_t nitems, void* data)
+{
+    apm_gzip_t* gzip = data;
+    size_t written = apm_gzip_read(gzip, buffer, size * nitems);
+
+    if (gzip->failed) {
+        return CURL_READFUNC_ABORT;
+    }
+    return written;
+}
+
 // Adiciona o cabeçalho de autorização "Authorization: Basic base64encode(username:password)".
 bool headers_add_basic_authorization(Headers* self, const char* username, const char* password)
 {
@@ -210,12 +252,28 @@ finally:
 
 // Realiza uma requisição HTTP à API REST do parceiro
 RESTResponse* request(const char* op, const char* url, const char* payload, Headers* headers, int flags)
+{
+    struct iovec body = { .iov_base = (void*)payload, .iov_len = payload ? strlen(payload) : 0 };
+    return request_iov(op, url, &body, payload ? 1 : 0, headers, flags);
+}
+
+// Realiza uma requisição HTTP cujo corpo é uma cadeia de trechos, enviados (e comprimidos) sem concatenação
+RESTResponse* request_iov(const char* op, const char* url, const struct iovec* payload, int count, Headers* headers, int flags)
 {
     trrlog(apm_facility, TRRLOG_DEBUG, "Enviando requisição HTTP %s para %s", op, url);
     CURL* curl;
     Payload from_server = { 0 };
-    char* compressed_payload = NULL;
-    size_t compressed_payload_size = 0;
+    Body to_server = { .chunks = payload, .count = count };
+    apm_gzip_t gzip = { 0 };
+    bool compressed = false;
+    size_t payload_size = 0;
+
+    if (!count) {
+        payload = NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        payload_size += payload[i].iov_len;
+    }
 
     // Inicializa a libcurl
     curl = curl_easy_init();
@@ -226,8 +284,12 @@ RESTResponse* request(const char* op, const char* url, const char* payload, Head
 
     if (payload && (flags & REQUEST_COMPRESS)) {
         trrlog(apm_facility, TRRLOG_DEBUG, "Conteúdo será comprimido");
-        compressed_payload = gzip_compress(payload, strlen(payload), &compressed_payload_size);
-        headers_add(headers, "Content-Encoding", "gzip");
+        if (apm_gzip_begin(&gzip, payload, count) == 0) {
+            compressed = true;
+            headers_add(headers, "Content-Encoding", "gzip");
+        } else {
+            trrlog(apm_facility, TRRLOG_ERR, "Compressor indisponível, enviando sem compressão");
+        }
     }
 
     // Adiciona os cabeçalhos
@@ -264,13 +326,25 @@ RESTResponse* request(const char* op, const char* url, const char* payload, Head
 
     // Loga e adiciona a payload, caso necessário
     trrlog(apm_facility, TRRLOG_DEBUG, ">>>>>>>>>>>> body");
-    if (compressed_payload) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, compressed_payload);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)compressed_payload_size);
+    if (payload && compressed) {
+        //! o tamanho comprimido só é conhecido no fim, então a libcurl envia com Transfer-Encoding: chunked
+        curl_easy_setopt(curl, CURLOPT_POST, 1);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, gzip_read_callback);
+        curl_easy_setopt(curl, CURLOPT_READDATA, (void*)&gzip);
         trrlog(apm_facility, TRRLOG_DEBUG, "(payload comprimido)");
+    } else if (payload && count == 1) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload[0].iov_base);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)payload_size);
+        trrlog(apm_facility, TRRLOG_DEBUG, "%.*s", (int)payload[0].iov_len, (const char*)payload[0].iov_base);
     } else if (payload) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-        trrlog(apm_facility, TRRLOG_DEBUG, "%s", payload);
+        //! mais de um trecho: a libcurl lê a cadeia direto, sem montar um buffer contíguo
+        curl_easy_setopt(curl, CURLOPT_POST, 1);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+        curl_easy_setopt(curl, CURLOPT_READDATA, (void*)&to_server);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)payload_size);
+        for (int i = 0; i < count; i++) {
+            trrlog(apm_facility, TRRLOG_DEBUG, "%.*s", (int)payload[i].iov_len, (const char*)payload[i].iov_base);
+        }
     } else {
         trrlog(apm_facility, TRRLOG_DEBUG, "(sem corpo)");
     }
@@ -292,9 +366,6 @@ RESTResponse* request(const char* op, const char* url, const char* payload, Head
     // Realiza a requisição
     curl_easy_perform(curl);
 
-    //! não precisamos mais do payload comprimido
-    free(compressed_payload);
-
     // Recupera o resultado
     long http_code;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
@@ -334,37 +405,3 @@ void rest_response_free(RESTResponse* result)
         free(result);
     }
 }
-
-// Function to compress data using zlib
-char* gzip_compress(const char* input, size_t input_size, size_t* output_size)
-{
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
-
-    if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-        return NULL;
-    }
-
-    size_t max_compressed_size = compressBound(input_size);
-    char* compressed_data = (char*)malloc(max_compressed_size);
-
-    if (!compressed_data) {
-        deflateEnd(&strm);
-        return NULL;
-    }
-
-    strm.next_in = (Bytef*)input;
-    strm.avail_in = input_size;
-    strm.next_out = (Bytef*)compressed_data;
-    strm.avail_out = max_compressed_size;
-
-    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
-        free(compressed_data);
-        deflateEnd(&strm);
-        return NULL;
-    }
-
-    *output_size = max_compressed_size - strm.avail_out;
-    deflateEnd(&strm);
-    return compressed_data;
-}
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <trrapm/apm.h>
+#include <trrapm/apm_internal.h>
+#include <trrapm/apm_sampler.h>
+
+//! peso do intervalo mais recente na média móvel do volume de cada nome
+#define APM_SAMPLER_SMOOTHING 0.5
+
+//! janela mínima usada para estimar o volume de um pico no começo do intervalo
+#define APM_SAMPLER_MIN_ELAPSED_NS 1000000ULL
+
+#define SLOT_FREE 0
+#define SLOT_FILLING 1
+#define SLOT_READY 2
+
+typedef struct {
+    int state;
+    int lock;
+    uint32_t hash;
+    char name[APM_SAMPLER_MAX_NAME + 1];
+
+    //! protegidos por lock
+    uint64_t window_start_ns;
+    uint32_t seen;
+    double per_second;
+    double rate;
+    double tokens;
+    uint64_t refill_ns;
+} apm_sampler_slot_t;
+
+static apm_sampler_slot_t sampler_table[APM_SAMPLER_SLOTS];
+static apm_sampler_slot_t sampler_overflow;
+static int sampler_entries = 0;
+
+static uint32_t apm_sampler_hash(const char* name, size_t* len);
+static apm_sampler_slot_t* apm_sampler_find(const char* name);
+static void apm_sampler_lock(apm_sampler_slot_t* slot);
+static void apm_sampler_unlock(apm_sampler_slot_t* slot);
+static void apm_sampler_update(apm_sampler_slot_t* slot, double max_per_second, uint64_t now);
+
+
+static uint32_t apm_sampler_hash(const char* name, size_t* len)
+{
+    //! fnv-1a, limitado ao tamanho guardado no slot
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+    for (; name[i] && i < APM_SAMPLER_MAX_NAME; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    *len = i;
+    return hash;
+}
+
+static apm_sampler_slot_t* apm_sampler_find(const char* name)
+{
+    size_t len = 0;
+    uint32_t hash = apm_sampler_hash(name, &len);
+
+    for (uint32_t i = 0; i < APM_SAMPLER_SLOTS; i++) {
+        apm_sampler_slot_t* slot = &sampler_table[(hash + i) & (APM_SAMPLER_SLOTS - 1)];
+        int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+        if (state == SLOT_FREE) {
+            if (__atomic_load_n(&sampler_entries, __ATOMIC_RELAXED) >= APM_SAMPLER_MAX_ENTRIES) {
+                return &sampler_overflow;
+            }
+
+            if (__atomic_compare_exchange_n(&slot->state, &state, SLOT_FILLING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_add_fetch(&sampler_entries, 1, __ATOMIC_RELAXED);
+                slot->hash = hash;
+                memcpy(slot->name, name, len);
+                slot->name[len] = '\0';
+                __atomic_store_n(&slot->state, SLOT_READY, __ATOMIC_RELEASE);
+                return slot;
+            }
+        }
+
+        //! outra thread está preenchendo a posição; o nome dela só é conhecido depois disso
+        while (state == SLOT_FILLING) {
+            state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        }
+
+        if (slot->hash == hash && strncmp(slot->name, name, len) == 0 && slot->name[len] == '\0') {
+            return slot;
+        }
+    }
+
+    return &sampler_overflow;
+}
+
+static void apm_sampler_lock(apm_sampler_slot_t* slot)
+{
+    //! a seção crítica são poucas contas; um mutex por nome custaria mais do que a espera
+    while (__atomic_exchange_n(&slot->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void apm_sampler_unlock(apm_sampler_slot_t* slot)
+{
+    __atomic_store_n(&slot->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void apm_sampler_update(apm_sampler_slot_t* slot, double max_per_second, uint64_t now)
+{
+    if (!slot->window_start_ns) {
+        //! primeira transação do nome: até o primeiro recálculo só o token bucket limita
+        slot->window_start_ns = now;
+        slot->refill_ns = now;
+        slot->per_second = -1;
+        slot->rate = 1;
+        slot->tokens = max_per_second;
+        return;
+    }
+
+    uint64_t elapsed = now - slot->window_start_ns;
+    if (elapsed >= APM_SAMPLER_INTERVAL_NS) {
+        double observed = (double)slot->seen * 1e9 / (double)elapsed;
+        slot->per_second = slot->per_second < 0 ? observed
+            : slot->per_second * (1 - APM_SAMPLER_SMOOTHING) + observed * APM_SAMPLER_SMOOTHING;
+        slot->rate = slot->per_second <= max_per_second ? 1 : apm_round_sample_rate(max_per_second / slot->per_second);
+        slot->window_start_ns = now;
+        slot->seen = 0;
+    }
+
+    //! o orçamento acumula no máximo um segundo, o suficiente para absorver a variação dentro do intervalo. ele pode
+    //! ficar negativo: um pico que a taxa reduzida ainda deixou passar é pago com o orçamento seguinte
+    slot->tokens += (double)(now - slot->refill_ns) * max_per_second / 1e9;
+    if (slot->tokens > max_per_second) {
+        slot->tokens = max_per_second;
+    }
+    slot->refill_ns = now;
+}
+
+bool apm_sampler_sample(const char* name, double max_per_second, double* rate)
+{
+    bool sampled = false;
+    apm_sampler_slot_t* slot = apm_sampler_find(name ? name : "");
+    uint64_t now = apm_monotonic_ns();
+    double draw = (double)(apm_random() >> 11) * 0x1.0p-53;
+
+    apm_sampler_lock(slot);
+    apm_sampler_update(slot, max_per_second, now);
+    slot->seen++;
+
+    //! sem orçamento, a taxa do nome cai na hora para o volume já visto no intervalo, em vez de descartar depois do
+    //! sorteio: assim a taxa informada é exatamente a probabilidade de a transação ser mantida
+    if (slot->tokens < 1) {
+        uint64_t elapsed = now - slot->window_start_ns;
+        if (elapsed < APM_SAMPLER_MIN_ELAPSED_NS) {
+            elapsed = APM_SAMPLER_MIN_ELAPSED_NS;
+        }
+
+        double observed = (double)slot->seen * 1e9 / (double)elapsed;
+        if (observed > max_per_second) {
+            double lowered = apm_round_sample_rate(max_per_second / observed);
+            if (lowered < slot->rate) {
+                slot->rate = lowered;
+            }
+        }
+    }
+
+    sampled = slot->rate >= 1 || draw < slot->rate;
+    if (sampled) {
+        slot->tokens -= 1;
+    }
+    *rate = slot->rate;
+    apm_sampler_unlock(slot);
+
+    return sampled;
+}
+
+double apm_round_sample_rate(double rate)
+{
+    //! o elastic propaga a taxa com 4 casas decimais; uma taxa positiva nunca vira 0
+    rate = (double)(int64_t)(rate * 10000 + 0.5) / 10000;
+    if (rate < 0.0001) {
+        rate = 0.0001;
+    }
+
+    return rate;
+}
+
+void apm_sampler_clear(void)
+{
+    //! só pode ser chamada quando nenhuma transação estiver começando
+    memset(sampler_table, 0, sizeof(sampler_table));
+    memset(&sampler_overflow, 0, sizeof(sampler_overflow));
+    sampler_entries = 0;
+}
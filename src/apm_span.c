@@ -1,283 +1,498 @@
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <trrlog1/trrlog.h>
 
-#include <trrmap/trrmap.h>
 #include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+#include <trrapm/apm_attr.h>
+#include <trrapm/apm_intern.h>
 #include <trrapm/apm_internal.h>
-#include <trrapm/cJSON.h>
+#include <trrapm/apm_ndjson.h>
 
+//! um span só entra na compressão se durar no máximo o limite da estratégia. limite 0 desliga a estratégia.
+#define COMPRESSIBLE_DURATION(duration, max) ((max) > 0 && (duration) <= (max))
 
-apm_span_t* apm_new_span(void)
+static const char* const compression_exact_match = "exact_match";
+static const char* const compression_same_kind = "same_kind";
+
+static bool apm_same_str(const char* a, const char* b);
+static bool apm_is_span_discardable(apm_span_t* span);
+static bool apm_is_span_compressible(apm_span_t* span);
+static void apm_unlink_span(apm_transaction_t* transaction, apm_span_t* span);
+static void apm_compress_span(apm_transaction_t* transaction, apm_span_t* span);
+static void apm_release_span(apm_transaction_t* transaction, apm_span_t* span);
+static apm_span_t* apm_begin_span_unlocked(apm_transaction_t* transaction, apm_span_t* parent, const char* name, const char* type, const char* subtype, const char* destination);
+static void apm_end_span_unlocked(apm_transaction_t* transaction, apm_span_t* span, const char* outcome);
+
+
+apm_span_t* apm_new_span(apm_transaction_t* transaction)
 {
-    struct timeval tv;
-    apm_span_t* span = calloc(1, sizeof(apm_span_t));
+    apm_span_t* span = NULL;
+
+    //! spans absorvidos pela compressão voltam para o pool da transação. o id não é reaproveitado porque erros
+    //! capturados dentro do span antigo ainda apontam para ele.
+    if (transaction->span_pool) {
+        span = transaction->span_pool;
+        transaction->span_pool = span->next;
+        memset(span, 0, sizeof(apm_span_t));
+    }
+    else {
+        span = apm_arena_alloc(transaction->arena, sizeof(apm_span_t));
+    }
     if (!span) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
-        goto catch;
+        return NULL;
     }
 
-    span->id = generate_id(SPAN_ID_LEN);
+    span->id = apm_arena_alloc(transaction->arena, SPAN_ID_LEN + 1);
     if (!span->id) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao gerar id único para o span.");
-        goto catch;
+        return NULL;
     }
+    apm_generate_id(span->id, SPAN_ID_LEN);
 
-    if (gettimeofday(&tv, NULL) != 0) {
-        trrlog(apm_facility, TRRLOG_ERR, "Erro ao obter horário da máquina.");
-    }
-    else {
-        span->timestamp = MICROS(tv);
-    }
+    //! a api por handle só recebe o span; os campos livres do contexto precisam chegar à arena da transação
+    span->transaction = transaction;
+    span->start_ns = apm_monotonic_ns();
 
-    goto finally;
-catch:
-    apm_free_span(span);
-    free(span);
-    span = NULL;
-finally:
     return span;
 }
 
-void apm_free_span(apm_span_t* span)
+apm_span_t* apm_begin_span_internal(apm_transaction_t* transaction, apm_span_t* parent, const char* name, const char* type, const char* subtype, const char* destination)
 {
-    if (span) {
-        free(span->id);
-        free(span->name);
-        free(span->type);
-        free(span->subtype);
-        free(span->transaction_id);
-        free(span->parent_id);
-        free(span->trace_id);
-        free(span->outcome);
-        trrmap_free((void **)&span->context);
-        Lfreelist(span->children);
-    }
+    //! com um contexto capturado, uma continuação em outra thread pode estar mexendo na mesma árvore e na mesma arena
+    bool locked = transaction && apm_lock_transaction(transaction);
+    apm_span_t* span = apm_begin_span_unlocked(transaction, parent, name, type, subtype, destination);
+    apm_unlock_transaction(transaction, locked);
+    return span;
 }
 
-void apm_begin_capture_span_internal(const char* name, const char* type, const char* subtype)
+static apm_span_t* apm_begin_span_unlocked(apm_transaction_t* transaction, apm_span_t* parent, const char* name, const char* type, const char* subtype, const char* destination)
 {
     apm_span_t* new_span = NULL;
-    apm_transaction_t* current_transaction = apm_get_current_transaction();
-    if (!current_transaction || !current_transaction->id || !current_transaction->trace_id) {
+    apm_arena_t* arena = NULL;
+    apm_config_t* config = NULL;
+    if (!transaction || !transaction->id || !transaction->trace_id) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada. [%s:%d]", __FILE__, __LINE__);
-        return;
+        return NULL;
+    }
+
+    //! transação não amostrada: nada de spans, nem alocação. o NULL é tratado como span descartado.
+    if (!transaction->sampled) {
+        return NULL;
+    }
+
+    //! acima do limite o span é apenas contado. quem chamou recebe NULL e o trata como um span descartado.
+    config = apm_get_config();
+    if (config && config->transaction_max_spans > 0 && transaction->span_count >= config->transaction_max_spans) {
+        transaction->span_dropped++;
+        trrlog(apm_facility, TRRLOG_DEBUG, "Limite de spans atingido, span descartado. [%s:%d]", __FILE__, __LINE__);
+        return NULL;
     }
 
     trrlog(apm_facility, TRRLOG_DEBUG, "Criando span. [%s:%d]", __FILE__, __LINE__);
 
-    new_span = apm_new_span();
+    new_span = apm_new_span(transaction);
     if (!new_span) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar span. [%s:%d]", __FILE__, __LINE__);
-        return; 
+        return NULL;
     }
+    transaction->span_count++;
 
-    new_span->name = dup_value_or_default(name, NULL);
-    new_span->type = dup_value_or_default(type, "code.custom");
-    new_span->subtype = dup_value_or_default(subtype, NULL);
-    new_span->transaction_id = dup_value_or_default(current_transaction->id, NULL);
-    new_span->trace_id = dup_value_or_default(current_transaction->trace_id, NULL);
+    arena = transaction->arena;
+    new_span->name = apm_intern_value_or_default(arena, name, NULL);
+    new_span->type = apm_intern_value_or_default(arena, type, "code.custom");
+    new_span->subtype = apm_intern_value_or_default(arena, subtype, NULL);
+
+    //! um destino marca o span como de saída (chamada a um serviço externo), candidato à compressão
+    if (destination) {
+        new_span->exit = true;
+        new_span->destination = apm_intern_value_or_default(arena, destination, NULL);
+    }
 
-    if (current_transaction->span_depth == 0) {
-        new_span->parent_id = dup_value_or_default(current_transaction->id, NULL);
-        if (current_transaction->children == NULL) {
-            current_transaction->children = Lopen();
+    //! os ids vivem na mesma arena que o span, então basta apontar para os da transação e do pai
+    new_span->transaction_id = transaction->id;
+    new_span->trace_id = transaction->trace_id;
+
+    //! os filhos ficam numa lista encadeada intrusiva, na ordem em que foram criados
+    new_span->parent = parent;
+    if (!parent) {
+        new_span->parent_id = transaction->id;
+        new_span->prev = transaction->last_child;
+        if (transaction->last_child) {
+            transaction->last_child->next = new_span;
+        } else {
+            transaction->children = new_span;
         }
-        Linsert(current_transaction->children, (char*)new_span, sizeof(apm_span_t), 1);
-        current_transaction->span_depth++;
+        transaction->last_child = new_span;
     } else {
-        //! Estou apenas com um span_depth
-        apm_span_t* current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-        new_span->parent_id = dup_value_or_default(current_span->id, NULL);
-        if (current_span->children == NULL) {
-            current_span->children = Lopen();
+        new_span->parent_id = parent->id;
+        new_span->prev = parent->last_child;
+        if (parent->last_child) {
+            parent->last_child->next = new_span;
+        } else {
+            parent->children = new_span;
         }
-        Linsert(current_span->children, (char*)new_span, sizeof(apm_span_t), 1);
+        parent->last_child = new_span;
     }
 
-    // Liberar a memória alocada para new_span após a inserção
-    free(new_span);
+    return new_span;
 }
 
-void apm_end_capture_span_internal(const char* outcome)
+void apm_end_span_internal(apm_transaction_t* transaction, apm_span_t* span, const char* outcome)
 {
-    struct timeval tv;
-    apm_span_t* current_span = NULL;
-    apm_transaction_t* current_transaction = apm_get_current_transaction();
-    if (!current_transaction) {
+    bool locked = transaction && apm_lock_transaction(transaction);
+    apm_end_span_unlocked(transaction, span, outcome);
+    apm_unlock_transaction(transaction, locked);
+}
+
+static void apm_end_span_unlocked(apm_transaction_t* transaction, apm_span_t* span, const char* outcome)
+{
+    if (!transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
         return;
     }
 
+    //! span descartado pelo limite de spans
+    if (!span) {
+        return;
+    }
+
     trrlog(apm_facility, TRRLOG_DEBUG, "Encerrando span [%s:%d]", __FILE__, __LINE__);
 
-    current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-    if (!current_span) {
-        trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
+    span->duration_ns = apm_monotonic_ns() - span->start_ns;
+    span->outcome = apm_intern_value_or_default(transaction->arena, outcome, FAILURE);
+
+    trrlog(apm_facility, TRRLOG_DEBUG, "span->id = %s [%s:%d]", span->id, __FILE__, __LINE__);
+    trrlog(apm_facility, TRRLOG_DEBUG, "span->name = %s [%s:%d]", span->name, __FILE__, __LINE__);
+
+    if (apm_is_span_discardable(span)) {
+        //! o span não é enviado: sai da árvore, devolve a memória ao pool e conta apenas como descartado
+        trrlog(apm_facility, TRRLOG_DEBUG, "Span abaixo da duração mínima, descartado. [%s:%d]", __FILE__, __LINE__);
+        apm_unlink_span(transaction, span);
+        apm_release_span(transaction, span);
+        transaction->span_count--;
+        transaction->span_dropped++;
         return;
     }
 
-    if (gettimeofday(&tv, NULL) != 0) {
-        trrlog(apm_facility, TRRLOG_ERR, "Erro ao obter horário da máquina.");
-    }
-    else {
-        current_span->duration = (double)(MICROS(tv) - current_span->timestamp) / 1000.0f;
+    if (apm_is_span_compressible(span)) {
+        span->composite_count = 1;
+        span->composite_sum_ns = span->duration_ns;
+        //! a partir daqui o span pode ter sido devolvido ao pool
+        apm_compress_span(transaction, span);
     }
-    current_span->outcome = dup_value_or_default(outcome, FAILURE);
+}
 
-    trrlog(apm_facility, TRRLOG_DEBUG, "current_span->id = %s [%s:%d]", current_span->id, __FILE__, __LINE__);
-    trrlog(apm_facility, TRRLOG_DEBUG, "current_span->name = %s [%s:%d]", current_span->name, __FILE__, __LINE__);
+void apm_begin_capture_span_internal(const char* name, const char* type, const char* subtype, const char* destination)
+{
+    apm_span_t* new_span = NULL;
+    apm_span_stack_t* stack = NULL;
+    apm_transaction_t* current_transaction = apm_get_current_transaction();
+    if (!current_transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada. [%s:%d]", __FILE__, __LINE__);
+        return;
+    }
 
-    if (strcmp(current_span->parent_id, current_span->transaction_id) == 0) {
-        current_transaction->span_depth--;
+    if (apm_reserve_span_stack() != 0) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar pilha de spans. [%s:%d]", __FILE__, __LINE__);
+        return;
     }
+
+    //! um span descartado também ocupa a pilha, com NULL, para que o end correspondente continue pareado
+    new_span = apm_begin_span_internal(current_transaction, apm_get_active_span(current_transaction), name, type, subtype, destination);
+    stack = apm_get_span_stack();
+    stack->spans[stack->depth++] = new_span;
 }
 
-void apm_add_str_to_span_context(char* value, ...)
+void apm_end_capture_span_internal(const char* outcome)
 {
-    apm_span_t* current_span = NULL;
     apm_transaction_t* current_transaction = apm_get_current_transaction();
     if (!current_transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
         return;
     }
 
-    current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-    if (!current_span) {
+    apm_span_stack_t* stack = apm_get_span_stack();
+    if (stack->depth == 0) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
         return;
-    }    
+    }
 
-    if (!current_span->context) {
-        current_span->context = trrmap_create_default();
+    apm_end_span_internal(current_transaction, stack->spans[--stack->depth], outcome);
+}
+
+void apm_vadd_to_span_context(apm_span_t* span, apm_attr_type_t type, void* value, va_list args)
+{
+    if (!span) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
+        return;
+    }
+
+    apm_set_span_field(span->transaction, span, type, value, args);
+}
+
+void apm_add_str_to_span_context(char* value, ...)
+{
+    apm_transaction_t* current_transaction = apm_get_current_transaction();
+    if (!current_transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
+        return;
+    }
+
+    //! span descartado
+    if (apm_get_span_stack()->depth && !apm_get_active_span(current_transaction)) {
+        return;
     }
 
     va_list args;
     va_start(args, value);
-    trrmap_vinsert(current_span->context, TRRMAP_VALUE_STR, value, args);
+    apm_vadd_to_span_context(apm_get_active_span(current_transaction), APM_ATTR_STR, value, args);
     va_end(args);
 }
 
 void apm_add_int_to_span_context(double* value, ...)
 {
-    apm_span_t* current_span = NULL;
     apm_transaction_t* current_transaction = apm_get_current_transaction();
     if (!current_transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
         return;
     }
 
-    current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-    if (!current_span) {
-        trrlog(apm_facility, TRRLOG_ERR, "Nenhum span foi iniciado.");
+    //! span descartado
+    if (apm_get_span_stack()->depth && !apm_get_active_span(current_transaction)) {
         return;
-    }    
-
-    if (!current_span->context) {
-        current_span->context = trrmap_create_default();
     }
 
     va_list args;
     va_start(args, value);
-    trrmap_vinsert(current_span->context, TRRMAP_VALUE_NUMBER, value, args);
+    apm_vadd_to_span_context(apm_get_active_span(current_transaction), APM_ATTR_NUMBER, value, args);
     va_end(args);
 }
 
-apm_span_t* apm_get_pending_span(apm_span_t* span)
+void apm_add_str_attr_to_span_context(apm_attr_key_t key, const char* value)
 {
-    if (!span) {
+    apm_transaction_t* current_transaction = apm_get_current_transaction();
+    if (!current_transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
+        return;
+    }
+
+    //! span descartado
+    if (apm_get_span_stack()->depth && !apm_get_active_span(current_transaction)) {
+        return;
+    }
+
+    apm_set_span_attr(current_transaction, apm_get_active_span(current_transaction), key, APM_ATTR_STR, value, 0);
+}
+
+void apm_add_int_attr_to_span_context(apm_attr_key_t key, int64_t value)
+{
+    apm_transaction_t* current_transaction = apm_get_current_transaction();
+    if (!current_transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
+        return;
+    }
+
+    //! span descartado
+    if (apm_get_span_stack()->depth && !apm_get_active_span(current_transaction)) {
+        return;
+    }
+
+    apm_set_span_attr(current_transaction, apm_get_active_span(current_transaction), key, APM_ATTR_INT, NULL, value);
+}
+
+apm_span_t* apm_pin_span(apm_span_t* span)
+{
+    //! o span acabou de ser criado: ninguém mais o conhece até quem pediu o handle recebê-lo
+    if (span) {
+        span->pinned = true;
+    }
+    return span;
+}
+
+apm_span_t* apm_get_active_span(apm_transaction_t* transaction)
+{
+    apm_span_stack_t* stack = apm_get_span_stack();
+    if (!transaction || stack->depth == 0) {
         return NULL;
     }
 
-    if (span->children) {
-        apm_span_t* child_span = NULL;
-        child_span = apm_get_pending_span((apm_span_t*)Lcurrent(span->children));
-        if (child_span) {
-            return child_span;
-        }
+    return stack->spans[stack->depth - 1];
+}
+
+static bool apm_same_str(const char* a, const char* b)
+{
+    //! strings internadas são comparadas pelo ponteiro; as demais caem no strcmp
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool apm_is_span_discardable(apm_span_t* span)
+{
+    apm_config_t* config = apm_get_config();
+    if (!config || config->exit_span_min_duration <= 0) {
+        return false;
     }
 
-    return span->outcome == NULL ? span : NULL;
+    //! um span capturado por apm_context_capture pode ainda receber filhos de uma continuação
+    if (span->captured || (!span->exit && !apm_same_str(span->type, "external"))) {
+        return false;
+    }
+
+    return !span->children && !span->error_count
+        && (double)span->duration_ns / 1000000.0 < config->exit_span_min_duration;
+}
+
+static bool apm_is_span_compressible(apm_span_t* span)
+{
+    apm_config_t* config = apm_get_config();
+    if (!config || (config->span_compression.exact_match_max_duration <= 0 && config->span_compression.same_kind_max_duration <= 0)) {
+        return false;
+    }
+
+    //! erros capturados no span apontam para o id dele (parent_id), que some quando ele é absorvido
+    return span->exit && !span->captured && !span->children && !span->error_count
+        && !apm_same_str(span->outcome, FAILURE);
 }
 
-void apm_dump_span(LIST spanlist, char** buffer, int* span_count)
+static void apm_compress_span(apm_transaction_t* transaction, apm_span_t* span)
 {
-    if (!buffer) {
+    apm_config_t* config = apm_get_config();
+    apm_span_t* prev = span->prev;
+    const char* strategy = NULL;
+
+    //! só o irmão imediatamente anterior, já encerrado e também compressível, pode absorver o span
+    if (!prev || prev->composite_count == 0) {
         return;
     }
 
-    Lwalk(spanlist, LARGHOME);
-    do {
-        apm_span_t* current_span = (apm_span_t*)Lcurrent(spanlist);
-        if (!current_span) {
-            continue;
-        }
+    double exact_max = config->span_compression.exact_match_max_duration;
+    double same_kind_max = config->span_compression.same_kind_max_duration;
+    double duration = (double)span->duration_ns / 1000000.0;
 
-        if (current_span->children) {
-            apm_dump_span(current_span->children, buffer, span_count);
+    bool same_kind = apm_same_str(prev->type, span->type) && apm_same_str(prev->subtype, span->subtype)
+        && apm_same_str(prev->destination, span->destination);
+    bool exact_match = same_kind && apm_same_str(prev->name, span->name);
+
+    if (prev->composite_count == 1) {
+        double prev_duration = (double)prev->duration_ns / 1000000.0;
+        if (exact_match && COMPRESSIBLE_DURATION(duration, exact_max) && COMPRESSIBLE_DURATION(prev_duration, exact_max)) {
+            strategy = compression_exact_match;
+        }
+        else if (same_kind && COMPRESSIBLE_DURATION(duration, same_kind_max) && COMPRESSIBLE_DURATION(prev_duration, same_kind_max)) {
+            strategy = compression_same_kind;
         }
+    }
+    else if (prev->compression_strategy == compression_exact_match) {
+        if (exact_match && COMPRESSIBLE_DURATION(duration, exact_max)) {
+            strategy = compression_exact_match;
+        }
+    }
+    else if (same_kind && COMPRESSIBLE_DURATION(duration, same_kind_max)) {
+        strategy = compression_same_kind;
+    }
 
-        //! vamos converter para json
-        char* partial_buffer = apm_span_to_json(current_span);
-        apm_free_span(current_span);
-        
-        if (partial_buffer) {
-            char *tmp = realloc(*buffer, strlen(*buffer) + strlen(partial_buffer) + 2);
-            if (tmp) {
-                *buffer = tmp;
-                strcat(*buffer, partial_buffer);
-                strcat(*buffer, "\n");
-            }
-
-            if (*span_count) {
-                *span_count += 1;
-            }
-
-            free(partial_buffer);
+    if (!strategy) {
+        return;
+    }
+
+    if (strategy == compression_same_kind && prev->compression_strategy != compression_same_kind) {
+        //! os nomes podem ser diferentes, então o composto passa a ser nomeado pelo destino
+        size_t len = strlen(prev->destination) + sizeof("Calls to ");
+        char* name = apm_arena_alloc(transaction->arena, len);
+        if (name) {
+            snprintf(name, len, "Calls to %s", prev->destination);
+            prev->name = name;
         }
-    } while (!Lwalk(spanlist, 1));
+    }
+
+    prev->compression_strategy = strategy;
+    prev->composite_count++;
+    prev->composite_sum_ns += span->duration_ns;
+    prev->duration_ns = span->start_ns + span->duration_ns - prev->start_ns;
+
+    apm_unlink_span(transaction, span);
+    apm_release_span(transaction, span);
 }
 
-char* apm_span_to_json(apm_span_t* span)
+static void apm_unlink_span(apm_transaction_t* transaction, apm_span_t* span)
 {
-    char* payload = NULL;
-    //! vamos converter para json
-    cJSON* json = cJSON_CreateObject();
-    if (!json) {
-        goto catch;
-    }
-
-    cJSON* fld_span = cJSON_AddObjectToObject(json, "span");
-    cJSON_AddStringToObject(fld_span, "id", span->id);
-    cJSON_AddStringToObject(fld_span, "transaction_id", span->transaction_id);
-    cJSON_AddStringToObject(fld_span, "trace_id", span->trace_id);
-    cJSON_AddStringToObject(fld_span, "parent_id", span->parent_id);
-    cJSON_AddStringToObject(fld_span, "name", span->name);
-    cJSON_AddStringToObject(fld_span, "type", span->type);
-    cJSON_AddStringToObject(fld_span, "subtype", span->subtype);
-    cJSON_AddNumberToObject(fld_span, "timestamp", span->timestamp);
-    cJSON_AddNumberToObject(fld_span, "duration", span->duration);
-    cJSON_AddStringToObject(fld_span, "outcome", span->outcome);
-
-    char* context_str = trrmap_serialize_json(span->context);
-    if (context_str) {
-        cJSON* fld_context = cJSON_Parse(context_str);
-        if (fld_context) {
-            cJSON_AddItemToObject(fld_span, "context", fld_context);
-        }
-        else {
-            trrlog(apm_facility, TRRLOG_ERR, "Erro ao fazer o parser do contexto do span.");
+    //! tira o span da lista de irmãos
+    if (span->prev) {
+        span->prev->next = span->next;
+    }
+    else if (span->parent) {
+        span->parent->children = span->next;
+    }
+    else {
+        transaction->children = span->next;
+    }
+
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+    else if (span->parent) {
+        span->parent->last_child = span->prev;
+    }
+    else {
+        transaction->last_child = span->prev;
+    }
+}
+
+static void apm_release_span(apm_transaction_t* transaction, apm_span_t* span)
+{
+    //! quem recebeu o handle ainda pode usá-lo depois do end; o span fica fora da árvore, mas a memória não é
+    //! reaproveitada
+    if (span->pinned) {
+        return;
+    }
+
+    span->next = transaction->span_pool;
+    transaction->span_pool = span;
+}
+
+void apm_dump_span(apm_transaction_t* transaction, apm_span_t* spans, apm_ndjson_t* writer)
+{
+    if (!writer) {
+        return;
+    }
+
+    for (apm_span_t* current_span = spans; current_span; current_span = current_span->next) {
+        if (current_span->children) {
+            apm_dump_span(transaction, current_span->children, writer);
         }
 
-        free(context_str);
+        apm_span_to_ndjson(transaction, current_span, writer);
     }
+}
+
+void apm_span_to_ndjson(apm_transaction_t* transaction, apm_span_t* span, apm_ndjson_t* writer)
+{
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("span"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("id"), span->id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("transaction_id"), span->transaction_id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("trace_id"), span->trace_id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("parent_id"), span->parent_id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("name"), span->name);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), span->type);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("subtype"), span->subtype);
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), apm_transaction_wall_time(transaction, span->start_ns));
+    apm_ndjson_number(writer, APM_NDJSON_KEY("duration"), (double)span->duration_ns / 1000000.0);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("outcome"), span->outcome);
+
+    if (span->composite_count > 1) {
+        apm_ndjson_begin_object(writer, APM_NDJSON_KEY("composite"));
+        apm_ndjson_int64(writer, APM_NDJSON_KEY("count"), span->composite_count);
+        apm_ndjson_number(writer, APM_NDJSON_KEY("sum"), (double)span->composite_sum_ns / 1000000.0);
+        apm_ndjson_string(writer, APM_NDJSON_KEY("compression_strategy"), span->compression_strategy);
+        apm_ndjson_end_object(writer);
+    }
+
+    //! atributos tipados e campos livres saem direto dos vetores do span
+    apm_span_context_to_ndjson(span, writer);
 
-    payload = cJSON_PrintUnformatted(json);
-    goto finally;
-catch:
-    cJSON_Delete(json);
-finally:
-    return payload;
+    apm_ndjson_end_event(writer);
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <trrapm/apm_traceparent.h>
+
+static int apm_hex_value(char c);
+static int apm_parse_hex_id(const char* str, size_t len, char* id);
+static const char* apm_skip_ows(const char* str);
+static int apm_parse_rate(const char* str, size_t len, double* rate);
+
+
+static int apm_hex_value(char c)
+{
+    //! o W3C aceita apenas hexadecimal minúsculo
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static int apm_parse_hex_id(const char* str, size_t len, char* id)
+{
+    bool zero = true;
+    for (size_t i = 0; i < len; i++) {
+        int value = apm_hex_value(str[i]);
+        if (value < 0) {
+            return -1;
+        }
+        zero = zero && value == 0;
+        id[i] = str[i];
+    }
+    id[len] = '\0';
+
+    //! ids só com zeros são inválidos
+    return zero ? -1 : 0;
+}
+
+static const char* apm_skip_ows(const char* str)
+{
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    return str;
+}
+
+static int apm_parse_rate(const char* str, size_t len, double* rate)
+{
+    //! sem strtod: o separador decimal do header é sempre '.', independente do locale do processo
+    double value = 0;
+    double scale = 1;
+    bool fraction = false;
+    bool digits = false;
+
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '.' && !fraction) {
+            fraction = true;
+        }
+        else if (str[i] >= '0' && str[i] <= '9') {
+            digits = true;
+            if (fraction) {
+                scale /= 10;
+                value += (str[i] - '0') * scale;
+            }
+            else {
+                value = value * 10 + (str[i] - '0');
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+
+    if (!digits || value > 1) {
+        return -1;
+    }
+
+    *rate = value;
+    return 0;
+}
+
+int apm_parse_traceparent(const char* header, apm_trace_context_t* context)
+{
+    if (!header || !context) {
+        return -1;
+    }
+
+    const char* str = apm_skip_ows(header);
+    size_t len = strlen(str);
+    while (len && (str[len - 1] == ' ' || str[len - 1] == '\t')) {
+        len--;
+    }
+
+    if (len < APM_TRACEPARENT_LEN) {
+        return -1;
+    }
+
+    int version_hi = apm_hex_value(str[0]);
+    int version_lo = apm_hex_value(str[1]);
+    if (version_hi < 0 || version_lo < 0 || str[2] != '-') {
+        return -1;
+    }
+
+    int version = version_hi << 4 | version_lo;
+    if (version == 0xff) {
+        return -1;
+    }
+
+    //! a versão 00 tem tamanho exato; versões futuras podem acrescentar campos depois de um '-'
+    if (version == 0 ? len != APM_TRACEPARENT_LEN : (len > APM_TRACEPARENT_LEN && str[APM_TRACEPARENT_LEN] != '-')) {
+        return -1;
+    }
+
+    const char* trace_id = str + 3;
+    const char* parent_id = trace_id + APM_TRACEPARENT_TRACE_ID_LEN + 1;
+    const char* flags = parent_id + APM_TRACEPARENT_PARENT_ID_LEN + 1;
+    if (trace_id[APM_TRACEPARENT_TRACE_ID_LEN] != '-' || parent_id[APM_TRACEPARENT_PARENT_ID_LEN] != '-') {
+        return -1;
+    }
+
+    apm_trace_context_t parsed;
+    if (apm_parse_hex_id(trace_id, APM_TRACEPARENT_TRACE_ID_LEN, parsed.trace_id) != 0) {
+        return -1;
+    }
+    if (apm_parse_hex_id(parent_id, APM_TRACEPARENT_PARENT_ID_LEN, parsed.parent_id) != 0) {
+        return -1;
+    }
+
+    int flags_hi = apm_hex_value(flags[0]);
+    int flags_lo = apm_hex_value(flags[1]);
+    if (flags_hi < 0 || flags_lo < 0) {
+        return -1;
+    }
+    parsed.flags = (uint8_t)(flags_hi << 4 | flags_lo);
+
+    //! só altera o contexto de quem chamou se o header inteiro for válido
+    memcpy(context->trace_id, parsed.trace_id, sizeof(parsed.trace_id));
+    memcpy(context->parent_id, parsed.parent_id, sizeof(parsed.parent_id));
+    context->flags = parsed.flags;
+    return 0;
+}
+
+int apm_parse_tracestate(const char* header, apm_trace_context_t* context)
+{
+    if (!context) {
+        return -1;
+    }
+
+    context->sample_rate = -1;
+    if (!header) {
+        return -1;
+    }
+
+    //! tracestate é uma lista "chave=valor,chave=valor". a entrada do elastic é "es=s:<taxa>[;outro:valor]".
+    const char* member = header;
+    while (*member) {
+        member = apm_skip_ows(member);
+        size_t member_len = strcspn(member, ",");
+
+        if (member_len > 3 && strncmp(member, "es=", 3) == 0) {
+            const char* entry = member + 3;
+            const char* end = member + member_len;
+            while (entry < end) {
+                size_t entry_len = strcspn(entry, ";,");
+                if (entry_len > 2 && strncmp(entry, "s:", 2) == 0) {
+                    double rate = 0;
+                    if (apm_parse_rate(entry + 2, entry_len - 2, &rate) != 0) {
+                        return -1;
+                    }
+                    context->sample_rate = rate;
+                    return 0;
+                }
+                entry += entry_len;
+                if (*entry == ';') {
+                    entry++;
+                }
+            }
+        }
+
+        member += member_len;
+        if (*member == ',') {
+            member++;
+        }
+    }
+
+    return -1;
+}
+
+int apm_format_traceparent(const char* trace_id, const char* parent_id, uint8_t flags, char* buffer, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (!trace_id || !parent_id || !buffer || size < APM_TRACEPARENT_LEN + 1) {
+        return -1;
+    }
+    if (strlen(trace_id) != APM_TRACEPARENT_TRACE_ID_LEN || strlen(parent_id) != APM_TRACEPARENT_PARENT_ID_LEN) {
+        return -1;
+    }
+
+    char* p = buffer;
+    memcpy(p, "00-", 3);
+    p += 3;
+    memcpy(p, trace_id, APM_TRACEPARENT_TRACE_ID_LEN);
+    p += APM_TRACEPARENT_TRACE_ID_LEN;
+    *p++ = '-';
+    memcpy(p, parent_id, APM_TRACEPARENT_PARENT_ID_LEN);
+    p += APM_TRACEPARENT_PARENT_ID_LEN;
+    *p++ = '-';
+    *p++ = hex[flags >> 4];
+    *p++ = hex[flags & 0xf];
+    *p = '\0';
+
+    return APM_TRACEPARENT_LEN;
+}
+
+int apm_format_tracestate(double sample_rate, char* buffer, size_t size)
+{
+    if (!buffer || size < APM_TRACESTATE_LEN || sample_rate < 0 || sample_rate > 1) {
+        return -1;
+    }
+
+    //! o elastic limita a taxa a 4 casas decimais. formatamos à mão pelo mesmo motivo do parser (locale).
+    int rate = (int)(sample_rate * 10000 + 0.5);
+    char* p = buffer;
+    memcpy(p, "es=s:", 5);
+    p += 5;
+
+    if (rate >= 10000 || rate <= 0) {
+        *p++ = rate > 0 ? '1' : '0';
+    }
+    else {
+        char digits[4];
+        int count = 4;
+        for (int i = 3; i >= 0; i--) {
+            digits[i] = (char)('0' + rate % 10);
+            rate /= 10;
+        }
+        while (digits[count - 1] == '0') {
+            count--;
+        }
+
+        *p++ = '0';
+        *p++ = '.';
+        memcpy(p, digits, count);
+        p += count;
+    }
+    *p = '\0';
+
+    return (int)(p - buffer);
+}
@@ -1,46 +1,116 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <trrlog1/trrlog.h>
 
 #include <trrapm/apm.h>
+#include <trrapm/apm_arena.h>
+#include <trrapm/apm_intern.h>
 #include <trrapm/apm_internal.h>
-#include <trrapm/cJSON.h>
+#include <trrapm/apm_ndjson.h>
+#include <trrapm/apm_sampler.h>
+#include <trrapm/apm_traceparent.h>
 
-static apm_transaction_t* current_transaction = NULL;
+#define SPAN_STACK_INITIAL_SIZE 8
+
+//! profundidade máxima de transações abertas ao mesmo tempo na mesma thread
+#define APM_TRANSACTION_STACK_MAX 32
+
+//! voltas de espera ativa no lock da transação antes de ceder a cpu para outra thread
+#define APM_LOCK_SPINS 64
+
+//! no handler de crash o lock é só tentado: quem o segura pode ser a própria thread que foi interrompida
+#define APM_LOCK_CRASH_SPINS 1024
+
+//! cada thread mantém a sua própria transação corrente. assim, servidores com várias threads de trabalho conseguem
+//! rastrear requisições concorrentes sem compartilhar estado (nem lock) no caminho quente.
+static __thread apm_transaction_t* current_transaction = NULL;
+
+//! transação de outra thread instalada por apm_context_restore. ela não foi empilhada aqui: o outer e a outer_stack
+//! dela pertencem a quem a iniciou, então esta thread nunca a desempilha nem a trata como órfã.
+static __thread apm_transaction_t* restored_transaction = NULL;
+
+//! a pilha de spans da api implícita também é da thread, e não da transação: uma continuação restaurada em outra
+//! thread (apm_context_restore) empilha os seus spans sem disputar a pilha de quem capturou. o bloco é reaproveitado
+//! entre transações e liberado quando a thread termina.
+static __thread apm_span_stack_t current_stack = { NULL, 0, 0 };
+
+//! na saída da thread, as transações que ficaram abertas são tratadas como órfãs e a pilha de spans é liberada
+static __thread bool thread_registered = false;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+//! ligado por apm_enter_crash_handler; o processo está morrendo e nenhum lock pode prender a thread
+static __thread bool crash_handler = false;
+
+static uint64_t transactions_nested = 0;
+static uint64_t transactions_orphaned = 0;
+
+static void apm_sample_transaction(apm_transaction_t* transaction, int sampled, double sample_rate);
+static void apm_push_current_transaction(apm_transaction_t* transaction);
+static void apm_orphan_transaction(apm_transaction_t* transaction);
+static void apm_thread_key_create(void);
+static void apm_register_thread(void);
+static void apm_thread_exit(void* data);
+static void apm_cpu_relax(void);
 
 apm_transaction_t* apm_new_transaction(const char* trace_id)
 {
     struct timeval tv;
-    apm_transaction_t* transaction = calloc(1, sizeof(apm_transaction_t));
+    apm_transaction_t* transaction = NULL;
+    apm_arena_t* arena = apm_arena_new();
+    if (!arena) {
+        trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
+        goto catch;
+    }
+
+    //! a transação, e tudo o que pertence a ela, é alocada na sua própria arena.
+    transaction = apm_arena_alloc(arena, sizeof(apm_transaction_t));
     if (!transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
         goto catch;
-    }    
+    }
+    transaction->arena = arena;
+    //! a referência de quem iniciou a transação; é devolvida por apm_finish_transaction
+    transaction->refs = 1;
 
-    transaction->id = generate_id(TRANSACTION_ID_LEN);
+    transaction->id = apm_arena_alloc(arena, TRANSACTION_ID_LEN + 1);
     if (!transaction->id) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao gerar id único para a transação.");
         goto catch;
     }
+    apm_generate_id(transaction->id, TRANSACTION_ID_LEN);
 
-    transaction->trace_id = (!trace_id) ? generate_id(TRACE_ID_LEN) : strdup(trace_id);
+    if (!trace_id) {
+        transaction->trace_id = apm_arena_alloc(arena, TRACE_ID_LEN + 1);
+        if (transaction->trace_id) {
+            apm_generate_id(transaction->trace_id, TRACE_ID_LEN);
+        }
+    } else {
+        transaction->trace_id = apm_arena_strdup(arena, trace_id);
+    }
     if (!transaction->trace_id) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao gerar trace id para a transação.");
         goto catch;
-    }    
+    }
 
+    //! a única leitura do relógio de parede da transação. todo o resto é medido no relógio monotônico e
+    //! convertido a partir desta âncora apenas na serialização.
     if (gettimeofday(&tv, NULL) != 0) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao obter horário da máquina.");
     }
     else {
         transaction->timestamp = MICROS(tv);
     }
+    transaction->start_ns = apm_monotonic_ns();
 
     goto finally;
 catch:
-    apm_free_transaction(transaction);
-    free(transaction);
+    apm_arena_free(arena);
     transaction = NULL;
 finally:
     return transaction;
@@ -49,50 +119,109 @@ finally:
 void apm_free_transaction(apm_transaction_t* transaction)
 {
     if (transaction) {
-        free(transaction->id);
-        free(transaction->name);
-        free(transaction->type);
-        free(transaction->trace_id);
-        free(transaction->parent_id);
-        free(transaction->outcome);
-        free(transaction->result);
-        Lfreelist(transaction->children);
-        Lfreelist(transaction->error);
+        //! spans, erros, contextos e stacktraces vêm todos da arena: nada é liberado um a um
+        apm_arena_free(transaction->arena);
     }
 }
 
-void apm_begin_capture_transaction_internal(const char* name, const char* type, const char* trace_id, const char* parent_id)
+static void apm_sample_transaction(apm_transaction_t* transaction, int sampled, double sample_rate)
+{
+    //! quem continua um trace herda a decisão de quem o iniciou; só a raiz decide
+    if (sampled >= 0) {
+        transaction->sampled = sampled != 0;
+        transaction->sample_rate = sample_rate;
+        return;
+    }
+
+    apm_config_t* config = apm_get_config();
+    if (config && config->transaction_max_per_second > 0) {
+        //! a taxa efetiva varia com o volume de cada nome e vai junto na transação, para o servidor extrapolar
+        transaction->sampled = apm_sampler_sample(transaction->name, config->transaction_max_per_second, &transaction->sample_rate);
+        return;
+    }
+
+    double rate = config ? config->transaction_sample_rate : 0;
+    if (rate == 0 || rate > 1) {
+        rate = 1;
+    }
+    else if (rate < 0) {
+        rate = 0;
+    }
+    else {
+        rate = apm_round_sample_rate(rate);
+    }
+
+    transaction->sample_rate = rate;
+    transaction->sampled = rate >= 1 || (double)(apm_random() >> 11) * 0x1.0p-53 < rate;
+}
+
+apm_transaction_t* apm_begin_transaction_internal(const char* name, const char* type, const char* trace_id, const char* parent_id, int sampled, double sample_rate)
 {
     trrlog(apm_facility, TRRLOG_DEBUG, "Criando transação [%s:%d]", __FILE__, __LINE__);
 
-    current_transaction = apm_new_transaction(trace_id);
-    if (!current_transaction) {
+    apm_transaction_t* transaction = apm_new_transaction(trace_id);
+    if (!transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar transação. [%s:%d]", __FILE__, __LINE__);
-        return;
+        return NULL;
     }
 
-    current_transaction->name = dup_value_or_default(name, NULL);
-    current_transaction->type = dup_value_or_default(type, NULL);
-    current_transaction->parent_id = dup_value_or_default(parent_id, NULL);
+    transaction->name = apm_arena_dup_value_or_default(transaction->arena, name, NULL);
+    transaction->type = apm_intern_value_or_default(transaction->arena, type, NULL);
+    transaction->parent_id = apm_arena_dup_value_or_default(transaction->arena, parent_id, NULL);
+    apm_sample_transaction(transaction, sampled, sample_rate);
+
+    return transaction;
 }
 
-void apm_end_capture_transaction_internal(const char* outcome, const char* result)
+apm_transaction_t* apm_continue_transaction_internal(const char* name, const char* type, const char* traceparent, const char* tracestate)
 {
-    struct timeval tv;
-    if (!current_transaction) {
+    apm_trace_context_t context;
+
+    //! sem traceparent válido a transação é a raiz de um novo trace
+    if (apm_parse_traceparent(traceparent, &context) != 0) {
+        return apm_begin_transaction_internal(name, type, NULL, NULL, -1, -1);
+    }
+
+    apm_parse_tracestate(tracestate, &context);
+    return apm_begin_transaction_internal(name, type, context.trace_id, context.parent_id,
+        (context.flags & APM_TRACE_FLAG_SAMPLED) != 0, context.sample_rate);
+}
+
+void apm_end_transaction_internal(apm_transaction_t* transaction, const char* outcome, const char* result)
+{
+    if (!transaction) {
         trrlog(apm_facility, TRRLOG_ERR, "Nenhuma transação foi iniciada.");
         return;
     }
 
     trrlog(apm_facility, TRRLOG_DEBUG, "Finalizando transação [%s:%d]", __FILE__, __LINE__);
 
-    gettimeofday(&tv, NULL);
-    current_transaction->outcome = dup_value_or_default(outcome, NULL);
-    current_transaction->result = dup_value_or_default(result, NULL);
-    current_transaction->duration = (double)(MICROS(tv) - current_transaction->timestamp) / 1000.0f;
+    //! uma continuação em outra thread pode estar alocando na mesma arena
+    bool locked = apm_lock_transaction(transaction);
+    transaction->duration_ns = apm_monotonic_ns() - transaction->start_ns;
+    transaction->outcome = apm_intern_value_or_default(transaction->arena, outcome, NULL);
+    transaction->result = apm_intern_value_or_default(transaction->arena, result, NULL);
+    apm_unlock_transaction(transaction, locked);
+
+    trrlog(apm_facility, TRRLOG_DEBUG, "transaction->id = %s [%s:%d]", transaction->id, __FILE__, __LINE__);
+    trrlog(apm_facility, TRRLOG_DEBUG, "transaction->name = %s [%s:%d]", transaction->name, __FILE__, __LINE__);
+}
 
-    trrlog(apm_facility, TRRLOG_DEBUG, "current_transaction->id = %s [%s:%d]", current_transaction->id, __FILE__, __LINE__);
-    trrlog(apm_facility, TRRLOG_DEBUG, "current_transaction->name = %s [%s:%d]", current_transaction->name, __FILE__, __LINE__);
+void apm_begin_capture_transaction_internal(const char* name, const char* type, const char* trace_id, const char* parent_id)
+{
+    //! os ids vindos de apm_get_traceparent_info não trazem as flags; antes só "-01" era aceito, então tratamos como
+    //! amostrado
+    apm_push_current_transaction(apm_begin_transaction_internal(name, type, trace_id, parent_id, trace_id ? 1 : -1, -1));
+}
+
+void apm_continue_capture_transaction_internal(const char* name, const char* type, const char* traceparent, const char* tracestate)
+{
+    apm_push_current_transaction(apm_continue_transaction_internal(name, type, traceparent, tracestate));
+}
+
+void apm_end_capture_transaction_internal(const char* outcome, const char* result)
+{
+    apm_end_transaction_internal(current_transaction, outcome, result);
 }
 
 apm_transaction_t* apm_get_current_transaction(void)
@@ -100,63 +229,268 @@ apm_transaction_t* apm_get_current_transaction(void)
     return current_transaction;
 }
 
-void apm_clear_current_transaction(void)
+void apm_set_current_transaction(apm_transaction_t* transaction)
 {
-    free(current_transaction);
-    current_transaction = NULL;
+    current_transaction = transaction;
 }
 
-void apm_dump_transaction(apm_transaction_t* transaction, char** buffer)
+apm_transaction_t* apm_get_restored_transaction(void)
 {
-    if (!buffer || !transaction) {
+    return restored_transaction;
+}
+
+void apm_set_restored_transaction(apm_transaction_t* transaction)
+{
+    restored_transaction = transaction;
+}
+
+static void apm_push_current_transaction(apm_transaction_t* transaction)
+{
+    //! se a criação falhou, a transação de fora continua a corrente. o end correspondente vai encerrá-la antes da
+    //! hora, mas só acontece sem memória.
+    if (!transaction) {
         return;
     }
 
-    //! vamos converter para json
-    char* partial_buffer = apm_transaction_to_json(transaction);
-    if (partial_buffer) {
-        char *tmp = realloc(*buffer, strlen(*buffer) + strlen(partial_buffer) + 2);
-        if (tmp) {
-            *buffer = tmp;
-            strcat(*buffer, partial_buffer);
-            strcat(*buffer, "\n");
+    apm_register_thread();
+
+    apm_transaction_t* outer = current_transaction;
+    if (outer && outer != restored_transaction && outer->nesting + 1 >= APM_TRANSACTION_STACK_MAX) {
+        //! uma transação iniciada a cada volta de um laço e nunca encerrada: a de cima é a que vazou
+        trrlog(apm_facility, TRRLOG_ERR, "Limite de transações aninhadas atingido. [%s:%d]", __FILE__, __LINE__);
+        apm_clear_current_transaction();
+        apm_orphan_transaction(outer);
+        outer = current_transaction;
+    }
+
+    if (outer) {
+        //! a de fora fica guardada, com a sua pilha de spans, até a de dentro terminar
+        __atomic_add_fetch(&transactions_nested, 1, __ATOMIC_RELAXED);
+        transaction->outer = outer;
+        transaction->nesting = outer->nesting + 1;
+        apm_swap_span_stack(&transaction->outer_stack);
+    }
+
+    current_transaction = transaction;
+}
+
+void apm_clear_current_transaction(void)
+{
+    //! a memória da transação pertence à arena, que é liberada depois do envio. spans que ficaram abertos na pilha
+    //! são abandonados junto com ela.
+    apm_transaction_t* transaction = current_transaction;
+    if (!transaction || !transaction->outer || transaction == restored_transaction) {
+        current_transaction = NULL;
+        current_stack.depth = 0;
+        return;
+    }
+
+    //! volta para a transação de fora e para a pilha dela; a pilha da de dentro é descartada
+    apm_swap_span_stack(&transaction->outer_stack);
+    free(transaction->outer_stack.spans);
+    memset(&transaction->outer_stack, 0, sizeof(transaction->outer_stack));
+
+    current_transaction = transaction->outer;
+    transaction->outer = NULL;
+}
+
+static void apm_orphan_transaction(apm_transaction_t* transaction)
+{
+    apm_config_t* config = apm_get_config();
+
+    __atomic_add_fetch(&transactions_orphaned, 1, __ATOMIC_RELAXED);
+    trrlog(apm_facility, TRRLOG_DEBUG, "Transação órfã: transaction->id = %s [%s:%d]", transaction->id, __FILE__, __LINE__);
+
+    //! com a política de descarte, apm_finish_transaction libera a transação sem enviar
+    transaction->orphaned = config && config->transaction_orphan_policy == APM_ORPHAN_DROP;
+    apm_end_transaction_internal(transaction, "unknown", NULL);
+    if (apm_finish_transaction(transaction)) {
+        apm_signal_flush();
+    }
+}
+
+void apm_orphan_current_transactions(void)
+{
+    //! encerra, da mais interna para a mais externa, as transações que a thread deixou abertas
+    while (current_transaction && current_transaction != restored_transaction) {
+        apm_transaction_t* transaction = current_transaction;
+        apm_clear_current_transaction();
+        apm_orphan_transaction(transaction);
+    }
+
+    //! um contexto restaurado e nunca liberado: a referência dele fica com o contexto, e a transação continua sendo
+    //! de quem a iniciou. as transações da thread guardadas por esse contexto só voltam com o release.
+    if (restored_transaction) {
+        trrlog(apm_facility, TRRLOG_ERR, "Contexto restaurado e não liberado. [%s:%d]", __FILE__, __LINE__);
+        current_transaction = NULL;
+        restored_transaction = NULL;
+    }
+}
+
+uint64_t apm_get_transactions_nested(void)
+{
+    return __atomic_load_n(&transactions_nested, __ATOMIC_RELAXED);
+}
+
+uint64_t apm_get_transactions_orphaned(void)
+{
+    return __atomic_load_n(&transactions_orphaned, __ATOMIC_RELAXED);
+}
+
+static void apm_thread_key_create(void)
+{
+    pthread_key_create(&thread_key, apm_thread_exit);
+}
+
+static void apm_register_thread(void)
+{
+    //! o valor da chave só precisa ser diferente de NULL para o destrutor rodar; o estado fica nas variáveis da thread
+    if (!thread_registered) {
+        pthread_once(&thread_key_once, apm_thread_key_create);
+        pthread_setspecific(thread_key, &current_stack);
+        thread_registered = true;
+    }
+}
+
+static void apm_thread_exit(void* data)
+{
+    apm_orphan_current_transactions();
+
+    free(current_stack.spans);
+    memset(&current_stack, 0, sizeof(current_stack));
+    thread_registered = false;
+}
+
+apm_span_stack_t* apm_get_span_stack(void)
+{
+    return &current_stack;
+}
+
+int apm_reserve_span_stack(void)
+{
+    if (current_stack.depth < current_stack.size) {
+        return 0;
+    }
+
+    //! a pilha só cresce. na prática poucas threads passam da capacidade inicial.
+    int new_size = current_stack.size ? current_stack.size * 2 : SPAN_STACK_INITIAL_SIZE;
+    apm_span_t** tmp = realloc(current_stack.spans, new_size * sizeof(apm_span_t*));
+    if (!tmp) {
+        return -1;
+    }
+
+    current_stack.spans = tmp;
+    current_stack.size = new_size;
+    apm_register_thread();
+    return 0;
+}
+
+void apm_swap_span_stack(apm_span_stack_t* stack)
+{
+    apm_span_stack_t tmp = current_stack;
+    current_stack = *stack;
+    *stack = tmp;
+}
+
+bool apm_lock_transaction(apm_transaction_t* transaction)
+{
+    //! enquanto só uma thread tem referência não há com quem disputar, e o lock é dispensado. a contagem só sai de 1
+    //! por apm_context_capture, chamada justamente por essa thread, então ela não muda entre o teste e o uso.
+    if (__atomic_load_n(&transaction->refs, __ATOMIC_ACQUIRE) <= 1) {
+        return false;
+    }
+
+    int spins = 0;
+    while (__atomic_exchange_n(&transaction->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&transaction->lock, __ATOMIC_RELAXED)) {
+            spins++;
+            if (crash_handler) {
+                //! segue sem o lock: um payload possivelmente inconsistente é melhor que travar o processo que está
+                //! morrendo
+                if (spins >= APM_LOCK_CRASH_SPINS) {
+                    return false;
+                }
+                apm_cpu_relax();
+            }
+            else if (spins % APM_LOCK_SPINS == 0) {
+                //! quem segura o lock pode ter perdido a cpu; continuar girando só atrasa a volta dele
+                sched_yield();
+            }
+            else {
+                apm_cpu_relax();
+            }
         }
+    }
+    return true;
+}
 
-        free(partial_buffer);
+static void apm_cpu_relax(void)
+{
+    //! avisa a cpu que é uma espera ativa: libera recursos para o outro hyperthread e evita o flush do pipeline na
+    //! saída do laço
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+void apm_enter_crash_handler(void)
+{
+    crash_handler = true;
+}
+
+bool apm_in_crash_handler(void)
+{
+    return crash_handler;
+}
+
+void apm_unlock_transaction(apm_transaction_t* transaction, bool locked)
+{
+    if (locked) {
+        __atomic_store_n(&transaction->lock, 0, __ATOMIC_RELEASE);
     }
 }
 
-char* apm_transaction_to_json(apm_transaction_t* transaction)
+uint64_t apm_transaction_wall_time(apm_transaction_t* transaction, uint64_t monotonic_ns)
 {
-    char* payload = NULL;
-    //! vamos converter para json
-    cJSON* json = cJSON_CreateObject();
-    if (!json) {
-        goto catch;
+    //! converte um instante do relógio monotônico em microssegundos de relógio de parede
+    return transaction->timestamp + (monotonic_ns - transaction->start_ns) / 1000;
+}
+
+void apm_dump_transaction(apm_transaction_t* transaction, apm_ndjson_t* writer)
+{
+    if (!writer || !transaction) {
+        return;
     }
 
-    cJSON* fld_transaction = cJSON_AddObjectToObject(json, "transaction");
-    cJSON_AddStringToObject(fld_transaction, "id", transaction->id);
-    cJSON_AddStringToObject(fld_transaction, "trace_id", transaction->trace_id);
+    apm_transaction_to_ndjson(transaction, writer);
+}
+
+void apm_transaction_to_ndjson(apm_transaction_t* transaction, apm_ndjson_t* writer)
+{
+    apm_ndjson_begin_event(writer, APM_NDJSON_KEY("transaction"));
+    apm_ndjson_string(writer, APM_NDJSON_KEY("id"), transaction->id);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("trace_id"), transaction->trace_id);
     if (transaction->parent_id && transaction->parent_id[0]) {
-        cJSON_AddStringToObject(fld_transaction, "parent_id", transaction->parent_id);
+        apm_ndjson_string(writer, APM_NDJSON_KEY("parent_id"), transaction->parent_id);
     }
 
-    cJSON_AddStringToObject(fld_transaction, "name", transaction->name);
-    cJSON_AddStringToObject(fld_transaction, "type", transaction->type);
-    cJSON_AddNumberToObject(fld_transaction, "timestamp", transaction->timestamp);
-    cJSON_AddNumberToObject(fld_transaction, "duration", transaction->duration);
-    cJSON_AddStringToObject(fld_transaction, "result", transaction->result);
-    cJSON_AddStringToObject(fld_transaction, "outcome", transaction->outcome);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("name"), transaction->name);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("type"), transaction->type);
+    apm_ndjson_uint64(writer, APM_NDJSON_KEY("timestamp"), transaction->timestamp);
+    apm_ndjson_number(writer, APM_NDJSON_KEY("duration"), (double)transaction->duration_ns / 1000000.0);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("result"), transaction->result);
+    apm_ndjson_string(writer, APM_NDJSON_KEY("outcome"), transaction->outcome);
+    apm_ndjson_bool(writer, APM_NDJSON_KEY("sampled"), transaction->sampled);
+    if (transaction->sample_rate >= 0) {
+        apm_ndjson_number(writer, APM_NDJSON_KEY("sample_rate"), transaction->sample_rate);
+    }
 
-    cJSON* fld_span_count = cJSON_AddObjectToObject(fld_transaction, "span_count");
-    cJSON_AddNumberToObject(fld_span_count, "started", transaction->span_count);
-    cJSON_AddNumberToObject(fld_span_count, "dropped", transaction->span_dropped);
+    apm_ndjson_begin_object(writer, APM_NDJSON_KEY("span_count"));
+    apm_ndjson_int64(writer, APM_NDJSON_KEY("started"), transaction->span_count);
+    apm_ndjson_int64(writer, APM_NDJSON_KEY("dropped"), transaction->span_dropped);
+    apm_ndjson_end_object(writer);
 
-    payload = cJSON_PrintUnformatted(json);
-    goto finally;
-catch:
-    cJSON_Delete(json);
-finally:
-    return payload;
+    apm_ndjson_end_event(writer);
 }
@@ -1,10 +1,14 @@
 #include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <regex.h>
+#include <time.h>
 #include <trrlog1/trrlog.h>
 #include <unistd.h>
+#include <sys/random.h>
 
 #include <trrapm/cJSON.h>
 
@@ -21,7 +25,18 @@ typedef struct {
     void* address;
 } apm_stack_entry_t;
 
+//! estado do gerador de ids, um por thread para não disputar o lock global do rand()
+static __thread uint64_t id_state[2];
+static __thread int id_seeded = 0;
+static __thread unsigned id_generation = 0;
+static unsigned id_fork_generation = 0;
+static pthread_once_t id_atfork_once = PTHREAD_ONCE_INIT;
+
 static int parse_stack_line(const char* line, apm_stack_entry_t* entry);
+static void apm_id_atfork_register(void);
+static void apm_id_atfork_child(void);
+static void apm_seed_id_state(void);
+static uint64_t apm_next_random(void);
 static int get_function_location(const char* exe_path, void* addr, char** function, char** location, char** lineno);
 
 static unsigned long  get_base_address_of_library(const char* lib_name) {
@@ -240,15 +255,88 @@ char* dup_value_or_default(const char* value, const char* def)
     }
 }
 
+static void apm_id_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, apm_id_atfork_child);
+}
+
+static void apm_seed_id_state(void)
+{
+    if (getrandom(id_state, sizeof(id_state), GRND_NONBLOCK) != sizeof(id_state)) {
+        //! sem entropia do kernel (muito cedo no boot ou seccomp); algo que ao menos difere entre processos e threads
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id_state[0] = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+        id_state[1] = (uint64_t)(uintptr_t)&id_state ^ (uint64_t)(uintptr_t)pthread_self();
+    }
+
+    //! o estado do xorshift128+ não pode ser todo zero
+    if (!id_state[0] && !id_state[1]) {
+        id_state[1] = 0x9e3779b97f4a7c15ULL;
+    }
+
+    id_generation = __atomic_load_n(&id_fork_generation, __ATOMIC_RELAXED);
+    id_seeded = 1;
+}
+
+static uint64_t apm_next_random(void)
+{
+    //! xorshift128+: não é criptográfico, mas ids de trace só precisam ser únicos
+    uint64_t s1 = id_state[0];
+    const uint64_t s0 = id_state[1];
+    id_state[0] = s0;
+    s1 ^= s1 << 23;
+    id_state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+    return id_state[1] + s0;
+}
+
+static void apm_id_atfork_child(void)
+{
+    __atomic_add_fetch(&id_fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t apm_random(void)
+{
+    //! o filho de um fork herda o estado da thread que chamou fork; sem resemear, pai e filho gerariam os mesmos ids
+    if (!id_seeded || id_generation != __atomic_load_n(&id_fork_generation, __ATOMIC_RELAXED)) {
+        pthread_once(&id_atfork_once, apm_id_atfork_register);
+        apm_seed_id_state();
+    }
+
+    return apm_next_random();
+}
+
+void apm_generate_id(char* id, int size)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    //! id precisa de espaço para size + 1 caracteres
+    int i = 0;
+    while (i < size) {
+        uint64_t r = apm_random();
+        for (int j = 0; j < 16 && i < size; j++, i++) {
+            id[i] = hex[r & 0xf];
+            r >>= 4;
+        }
+    }
+    id[size] = '\0';
+}
+
+uint64_t apm_monotonic_ns(void)
+{
+    //! CLOCK_MONOTONIC é servido pelo vDSO, sem syscall, e não salta quando o ntp ajusta o relógio
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 char* generate_id(int size)
 {
     char* id = NULL;
 
     id = calloc(1, size + 1);
     if (id) {
-        for (int i = 0; i < size; i += 2) {
-            snprintf(&id[i], 3, "%02x", rand() % 255);
-        }
+        apm_generate_id(id, size);
     }
 
     return id;
@@ -57,6 +57,7 @@
 #endif
 
 #include "trrapm/cJSON.h"
+#include "trrapm/apm_escape.h"
 
 /* define our own boolean type */
 #ifdef true
@@ -829,7 +830,8 @@ static cJSON_bool print_string_ptr(const unsigned char* const input, printbuffer
     }
 
     /* set "flag" to 1 if something needs to be escaped */
-    for (input_pointer = input; *input_pointer; input_pointer++) {
+    /* apm: clean runs are skipped by the vectorized scan, only the bytes it stops at are classified */
+    for (input_pointer = input; *(input_pointer = (const unsigned char*)apm_escape_scan((const char*)input_pointer)); input_pointer++) {
         switch (*input_pointer) {
         case '\"':
         case '\\':
@@ -870,40 +872,43 @@ static cJSON_bool print_string_ptr(const unsigned char* const input, printbuffer
     output_pointer = output + 1;
     /* copy the string */
     for (input_pointer = input; *input_pointer != '\0'; (void)input_pointer++, output_pointer++) {
-        if ((*input_pointer > 31) && (*input_pointer != '\"') && (*input_pointer != '\\')) {
-            /* normal character, copy */
-            *output_pointer = *input_pointer;
-        } else {
-            /* character needs to be escaped */
-            *output_pointer++ = '\\';
-            switch (*input_pointer) {
-            case '\\':
-                *output_pointer = '\\';
-                break;
-            case '\"':
-                *output_pointer = '\"';
-                break;
-            case '\b':
-                *output_pointer = 'b';
-                break;
-            case '\f':
-                *output_pointer = 'f';
-                break;
-            case '\n':
-                *output_pointer = 'n';
-                break;
-            case '\r':
-                *output_pointer = 'r';
-                break;
-            case '\t':
-                *output_pointer = 't';
-                break;
-            default:
-                /* escape and print as unicode codepoint */
-                sprintf((char*)output_pointer, "u%04x", *input_pointer);
-                output_pointer += 4;
-                break;
-            }
+        /* apm: bulk copy the clean run up to the next character that needs escaping */
+        const unsigned char* run_end = (const unsigned char*)apm_escape_scan((const char*)input_pointer);
+        memcpy(output_pointer, input_pointer, (size_t)(run_end - input_pointer));
+        output_pointer += run_end - input_pointer;
+        input_pointer = run_end;
+        if (*input_pointer == '\0') {
+            break;
+        }
+        /* character needs to be escaped */
+        *output_pointer++ = '\\';
+        switch (*input_pointer) {
+        case '\\':
+            *output_pointer = '\\';
+            break;
+        case '\"':
+            *output_pointer = '\"';
+            break;
+        case '\b':
+            *output_pointer = 'b';
+            break;
+        case '\f':
+            *output_pointer = 'f';
+            break;
+        case '\n':
+            *output_pointer = 'n';
+            break;
+        case '\r':
+            *output_pointer = 'r';
+            break;
+        case '\t':
+            *output_pointer = 't';
+            break;
+        default:
+            /* escape and print as unicode codepoint */
+            sprintf((char*)output_pointer, "u%04x", *input_pointer);
+            output_pointer += 4;
+            break;
         }
     }
     output[output_length + 1] = '\"';
@@ -9,6 +9,7 @@
 #include <trrlog1/trrlog.h>
 #include <trrapm/apm.h>
 #include <trrapm/apm_internal.h>
+#include <trrapm/apm_traceparent.h>
 
 #define LIBCURL_SO "libcurl.so.4"
 
@@ -23,20 +24,21 @@ struct CURLset {
     struct curl_slist* header;
 }; 
 
-//! Não é thread-safe
-#warning not thread-safe
-static struct CURLset set = {0};
+//! cada thread registra as opções do seu próprio handle curl, da mesma forma que a transação corrente.
+static __thread struct CURLset set = {0};
 
 static void add_traceparent_header(CURL* curl);
+static void get_url_destination(const char* url, char* destination, size_t size);
 CURLcode (*curl_easy_perform_s)(CURL*) = NULL;
 CURLcode (*curl_easy_setopt_s)(CURL*, CURLoption, ...) = NULL;
 void (*curl_easy_cleanup_s)(CURL*) = NULL;
 
 static void add_traceparent_header(CURL* curl)
 {
-    char *trace_id = NULL;
-    char *parent_id = NULL;
-    char *traceparent = NULL;
+    const char *trace_id = NULL;
+    const char *parent_id = NULL;
+    char traceparent[sizeof("traceparent: ") + APM_TRACEPARENT_LEN];
+    char tracestate[sizeof("tracestate: ") + APM_TRACESTATE_LEN];
 
     if (!curl) {
         return;
@@ -48,9 +50,9 @@ static void add_traceparent_header(CURL* curl)
         return;
     }
 
-    if (current_transaction->children) {
-        apm_span_t* current_span = apm_get_pending_span((apm_span_t*)Lcurrent(current_transaction->children));
-        if (!current_span || !current_span->trace_id || !current_span->id) {
+    apm_span_t* current_span = apm_get_active_span(current_transaction);
+    if (current_span) {
+        if (!current_span->trace_id || !current_span->id) {
             trrlog(apm_facility, TRRLOG_ERR, "Nenhuma span foi iniciado.");
             return;
         }
@@ -66,7 +68,12 @@ static void add_traceparent_header(CURL* curl)
         parent_id = current_transaction->id;
     }
 
-    if (asprintf(&traceparent, "traceparent: 00-%s-%s-01", trace_id, parent_id)==-1) {
+    //! o header é montado na pilha; a única cópia é a que o curl_slist_append faz
+    memcpy(traceparent, "traceparent: ", sizeof("traceparent: ") - 1);
+    //! a decisão de amostragem segue para os serviços chamados
+    uint8_t flags = current_transaction->sampled ? APM_TRACE_FLAG_SAMPLED : 0;
+    if (apm_format_traceparent(trace_id, parent_id, flags, traceparent + sizeof("traceparent: ") - 1,
+            sizeof(traceparent) - (sizeof("traceparent: ") - 1)) < 0) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao criar header \"traceparent\".");
         return;
     }
@@ -74,16 +81,46 @@ static void add_traceparent_header(CURL* curl)
     struct curl_slist* tmp = curl_slist_append(set.header, traceparent);
     if (!tmp) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao adicionar header \"traceparent\".");
-        free(traceparent);
         return;
 
     }
+
+    memcpy(tracestate, "tracestate: ", sizeof("tracestate: ") - 1);
+    if (apm_format_tracestate(current_transaction->sample_rate, tracestate + sizeof("tracestate: ") - 1,
+            sizeof(tracestate) - (sizeof("tracestate: ") - 1)) > 0) {
+        struct curl_slist* state = curl_slist_append(tmp, tracestate);
+        if (state) {
+            tmp = state;
+        }
+        else {
+            trrlog(apm_facility, TRRLOG_ERR, "Erro ao adicionar header \"tracestate\".");
+        }
+    }
     
     if (curl_easy_setopt_s(curl, CURLOPT_HTTPHEADER, tmp) != CURLE_OK) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao configurar header na chamada curl.");
     }
+}
+
+static void get_url_destination(const char* url, char* destination, size_t size)
+{
+    //! o destino é o host[:porta] da url (scheme://[user@]host[:porta]/...). chamadas para o mesmo destino
+    //! podem ser comprimidas num único span.
+    const char* begin = url ? strstr(url, "://") : NULL;
+    begin = begin ? begin + 3 : (url ? url : "");
+
+    size_t len = strcspn(begin, "/?#");
+    const char* at = memchr(begin, '@', len);
+    if (at) {
+        len -= (size_t)(at + 1 - begin);
+        begin = at + 1;
+    }
 
-    free(traceparent);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(destination, begin, len);
+    destination[len] = '\0';
 }
 
 #undef curl_easy_setopt
@@ -191,18 +228,26 @@ void curl_easy_cleanup(CURL* curl)
 CURLcode curl_easy_perform(CURL* curl)
 {
     CURLcode ret;
-    char* full_url = NULL;
+    char* span_name = NULL;
+    const char* method = NULL;
+    char destination[256];
     apm_config_t* apm_config = apm_get_config();
     if (!(apm_config && !apm_config->bypass)) {
         goto catch;
     }
 
-    if (asprintf(&full_url, "%s %s", set.method, set.url)==-1 || !full_url) {
+    //! sem CURLOPT_POST, CURLOPT_NOBODY ou CURLOPT_CUSTOMREQUEST a libcurl faz um GET
+    method = set.method ? set.method : HTTP_GET;
+    get_url_destination(set.url, destination, sizeof(destination));
+
+    //! o nome do span é internado: só o método e o destino entram nele. a url completa (caminho, query) tem
+    //! cardinalidade alta e vai no atributo http.url.
+    if (asprintf(&span_name, "%s %s", method, destination)==-1 || !span_name) {
         trrlog(apm_facility, TRRLOG_ERR, "Erro ao alocar memória.");
         goto catch;
     }
 
-    apm_begin_capture_span((const char*)full_url, "external", "http");
+    apm_begin_capture_exit_span((const char*)span_name, "external", "http", destination);
     //! adiciona traceparent header para tracing distribuído.
     add_traceparent_header(curl);
 
@@ -224,22 +269,20 @@ CURLcode curl_easy_perform(CURL* curl)
     }
 
     if (ret == CURLE_OK) {
-        double code = (double)http_code;
-        apm_add_int_to_span_context(&code, "http", "status_code", NULL);
+        apm_add_int_attr_to_span_context(APM_ATTR_HTTP_STATUS_CODE, http_code);
     }
 
-    apm_add_str_to_span_context(set.url, "service", "target", "name", NULL);
-    apm_add_str_to_span_context("http", "service", "target", "type", NULL);
+    apm_add_str_attr_to_span_context(APM_ATTR_SERVICE_TARGET_NAME, set.url);
+    apm_add_str_attr_to_span_context(APM_ATTR_SERVICE_TARGET_TYPE, "http");
 
-    double port = (double)remote_port;
-    apm_add_str_to_span_context(set.url, "destination", "service", "name", NULL);
-    apm_add_str_to_span_context(set.url, "destination", "service", "resource", NULL);
-    apm_add_str_to_span_context("external", "destination", "service", "type", NULL);
-    apm_add_str_to_span_context(set.url, "destination", "address", NULL);
-    apm_add_int_to_span_context(&port, "destination", "port", NULL);
+    apm_add_str_attr_to_span_context(APM_ATTR_DESTINATION_SERVICE_NAME, set.url);
+    apm_add_str_attr_to_span_context(APM_ATTR_DESTINATION_SERVICE_RESOURCE, set.url);
+    apm_add_str_attr_to_span_context(APM_ATTR_DESTINATION_SERVICE_TYPE, "external");
+    apm_add_str_attr_to_span_context(APM_ATTR_DESTINATION_ADDRESS, set.url);
+    apm_add_int_attr_to_span_context(APM_ATTR_DESTINATION_PORT, remote_port);
 
-    apm_add_str_to_span_context(set.url, "http", "url", NULL);
-    apm_add_str_to_span_context(set.method, "http", "method", NULL);
+    apm_add_str_attr_to_span_context(APM_ATTR_HTTP_URL, set.url);
+    apm_add_str_attr_to_span_context(APM_ATTR_HTTP_METHOD, method);
 
     apm_end_capture_span(outcome);
     
@@ -248,7 +291,7 @@ catch:
     //! em caso de erro, ainda tentamos chamar o curl.
     ret = curl_easy_perform_s(curl);
 finally:
-    free(full_url);
+    free(span_name);
     return ret;
 }
 
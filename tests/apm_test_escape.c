@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <trrapm/apm_escape.h>
+
+//! apm_escape_scan contra o laço byte a byte em todo alinhamento, tamanho e byte especial, com as strings coladas numa
+//! página protegida: uma leitura além do bloco do '\0' derruba o teste
+
+#define MAX_LEN 200
+#define OFFSETS 64
+
+static const char* apm_test_scan_reference(const char* s);
+static int apm_test_check(const char* s, size_t len, size_t offset, int byte);
+
+
+static const char* apm_test_scan_reference(const char* s)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    while (*p >= 0x20 && *p != '"' && *p != '\\') {
+        p++;
+    }
+    return (const char*)p;
+}
+
+static int apm_test_check(const char* s, size_t len, size_t offset, int byte)
+{
+    const char* expected = apm_test_scan_reference(s);
+    const char* found = apm_escape_scan(s);
+    if (found != expected) {
+        printf("tamanho %zu, deslocamento %zu, byte 0x%02x: achou %td, esperado %td\n", len, offset, byte, found - s,
+               expected - s);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int failures = 0;
+
+    //! duas páginas, a segunda sem acesso
+    char* region = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED || mprotect(region + page, page, PROT_NONE) != 0) {
+        perror("mmap");
+        return 1;
+    }
+    char* guard = region + page;
+
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        //! sem byte especial: só o '\0', no último byte antes da página protegida e em cada deslocamento do início
+        char* s = guard - len - 1;
+        memset(s, 'a', len);
+        s[len] = '\0';
+        failures += apm_test_check(s, len, (size_t)(s - region), 0);
+
+        for (size_t offset = 0; offset < OFFSETS; offset++) {
+            s = region + offset;
+            memset(s, 'a', len);
+            s[len] = '\0';
+            failures += apm_test_check(s, len, offset, 0);
+        }
+
+        //! um byte qualquer em cada posição da string colada na página protegida
+        s = guard - len - 1;
+        for (size_t i = 0; i < len; i++) {
+            for (int byte = 1; byte < 256; byte++) {
+                memset(s, 'a', len);
+                s[i] = (char)byte;
+                failures += apm_test_check(s, len, (size_t)(s - region), byte);
+            }
+        }
+    }
+
+    //! os bytes especiais mais comuns em cada posição e cada deslocamento
+    static const char specials[] = { '"', '\\', '\n', '\t', 0x1f, 0x01 };
+    for (size_t offset = 0; offset < OFFSETS; offset++) {
+        for (size_t len = 1; len < MAX_LEN; len++) {
+            char* s = region + offset;
+            for (size_t i = 0; i < len; i++) {
+                for (size_t k = 0; k < sizeof(specials); k++) {
+                    memset(s, 0x7f, len);
+                    s[len] = '\0';
+                    s[i] = specials[k];
+                    failures += apm_test_check(s, len, offset, (unsigned char)specials[k]);
+                }
+            }
+        }
+    }
+
+    munmap(region, page * 2);
+    printf("apm_test_escape: %d falha(s)\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <trrapm/apm_traceparent.h>
+
+//! tabelas de headers traceparent e tracestate válidos e inválidos, e a volta formatar -> parsear
+
+#define TRACE_ID "0af7651916cd43dd8448eb211c80319c"
+#define PARENT_ID "b7ad6b7169203331"
+
+typedef struct {
+    const char* header;
+    int result;
+    const char* trace_id;
+    const char* parent_id;
+    int flags;
+} apm_test_traceparent_t;
+
+typedef struct {
+    const char* header;
+    int result;
+    double sample_rate;
+} apm_test_tracestate_t;
+
+typedef struct {
+    double sample_rate;
+    int result;
+    const char* expected;
+} apm_test_format_t;
+
+static const apm_test_traceparent_t traceparents[] = {
+    { "00-" TRACE_ID "-" PARENT_ID "-01", 0, TRACE_ID, PARENT_ID, 0x01 },
+    { "00-" TRACE_ID "-" PARENT_ID "-00", 0, TRACE_ID, PARENT_ID, 0x00 },
+    { "00-" TRACE_ID "-" PARENT_ID "-ff", 0, TRACE_ID, PARENT_ID, 0xff },
+    { " \t00-" TRACE_ID "-" PARENT_ID "-01\t ", 0, TRACE_ID, PARENT_ID, 0x01 },
+    //! versões futuras aceitam campos a mais depois de um '-'
+    { "01-" TRACE_ID "-" PARENT_ID "-01", 0, TRACE_ID, PARENT_ID, 0x01 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-01-what-the-future-will-be-like", 0, TRACE_ID, PARENT_ID, 0x01 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-01what", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-01-", -1, NULL, NULL, 0 },
+    { "ff-" TRACE_ID "-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "0g-" TRACE_ID "-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00_" TRACE_ID "-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "_" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "_01", -1, NULL, NULL, 0 },
+    { "00-00000000000000000000000000000000-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-0000000000000000-01", -1, NULL, NULL, 0 },
+    { "00-0AF7651916CD43DD8448EB211C80319C-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-0x", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-1", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "1-" PARENT_ID "-01", -1, NULL, NULL, 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "1-01", -1, NULL, NULL, 0 },
+    { "", -1, NULL, NULL, 0 },
+    { NULL, -1, NULL, NULL, 0 },
+};
+
+static const apm_test_tracestate_t tracestates[] = {
+    { "es=s:0.5", 0, 0.5 },
+    { "es=s:1", 0, 1 },
+    { "es=s:0", 0, 0 },
+    { "es=s:.25", 0, 0.25 },
+    { "es=s:0.0001", 0, 0.0001 },
+    { "es=a:b;s:0.75", 0, 0.75 },
+    { "es=s:0.3;a:b", 0, 0.3 },
+    { "vendor=x,es=s:0.1", 0, 0.1 },
+    { "vendor=x, \tes=s:0.2,other=y", 0, 0.2 },
+    { "es=s:1.5", -1, -1 },
+    { "es=s:", -1, -1 },
+    { "es=s:0.5.1", -1, -1 },
+    { "es=s:-0.5", -1, -1 },
+    { "es=s:0,5", 0, 0 },
+    { "es=a:b", -1, -1 },
+    { "xes=s:0.5", -1, -1 },
+    { "vendor=x", -1, -1 },
+    { "", -1, -1 },
+    { NULL, -1, -1 },
+};
+
+static const apm_test_format_t formats[] = {
+    { 1, 6, "es=s:1" },
+    { 0, 6, "es=s:0" },
+    { 0.5, 8, "es=s:0.5" },
+    { 0.25, 9, "es=s:0.25" },
+    { 0.1234, 11, "es=s:0.1234" },
+    { 0.12346, 11, "es=s:0.1235" },
+    { 0.00004, 6, "es=s:0" },
+    { 0.99996, 6, "es=s:1" },
+    { 0.01, 9, "es=s:0.01" },
+    { -0.1, -1, NULL },
+    { 1.1, -1, NULL },
+};
+
+static int apm_test_traceparents(void);
+static int apm_test_tracestates(void);
+static int apm_test_formats(void);
+
+
+static int apm_test_traceparents(void)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(traceparents) / sizeof(traceparents[0]); i++) {
+        const apm_test_traceparent_t* test = &traceparents[i];
+        apm_trace_context_t context;
+        memset(&context, 'x', sizeof(context));
+
+        int result = apm_parse_traceparent(test->header, &context);
+        if (result != test->result) {
+            printf("traceparent \"%s\": retorno %d, esperado %d\n", test->header ? test->header : "(null)", result, test->result);
+            failures++;
+            continue;
+        }
+
+        if (result == 0 && (strcmp(context.trace_id, test->trace_id) != 0 || strcmp(context.parent_id, test->parent_id) != 0
+                            || context.flags != test->flags)) {
+            printf("traceparent \"%s\": lido %s %s %02x\n", test->header, context.trace_id, context.parent_id, context.flags);
+            failures++;
+        }
+
+        //! um header inválido não pode mexer no contexto
+        if (result != 0 && (context.trace_id[0] != 'x' || context.parent_id[0] != 'x')) {
+            printf("traceparent \"%s\": contexto alterado\n", test->header);
+            failures++;
+        }
+    }
+
+    //! formatar e parsear de novo devolve os mesmos campos
+    char buffer[APM_TRACEPARENT_LEN + 1];
+    for (int flags = 0; flags < 256; flags++) {
+        apm_trace_context_t context;
+        if (apm_format_traceparent(TRACE_ID, PARENT_ID, (uint8_t)flags, buffer, sizeof(buffer)) != APM_TRACEPARENT_LEN
+            || apm_parse_traceparent(buffer, &context) != 0 || strcmp(context.trace_id, TRACE_ID) != 0
+            || strcmp(context.parent_id, PARENT_ID) != 0 || context.flags != flags) {
+            printf("traceparent formatado com flags %02x não volta igual: \"%s\"\n", flags, buffer);
+            failures++;
+        }
+    }
+
+    if (apm_format_traceparent(TRACE_ID, PARENT_ID, 0, buffer, APM_TRACEPARENT_LEN) != -1
+        || apm_format_traceparent(TRACE_ID "0", PARENT_ID, 0, buffer, sizeof(buffer)) != -1
+        || apm_format_traceparent(TRACE_ID, NULL, 0, buffer, sizeof(buffer)) != -1) {
+        printf("traceparent formatado com argumentos inválidos\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+static int apm_test_tracestates(void)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(tracestates) / sizeof(tracestates[0]); i++) {
+        const apm_test_tracestate_t* test = &tracestates[i];
+        apm_trace_context_t context;
+        context.sample_rate = 2;
+
+        int result = apm_parse_tracestate(test->header, &context);
+        if (result != test->result || context.sample_rate < test->sample_rate - 1e-9
+            || context.sample_rate > test->sample_rate + 1e-9) {
+            printf("tracestate \"%s\": retorno %d taxa %g, esperado %d taxa %g\n", test->header ? test->header : "(null)", result,
+                   context.sample_rate, test->result, test->sample_rate);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+static int apm_test_formats(void)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        const apm_test_format_t* test = &formats[i];
+        char buffer[APM_TRACESTATE_LEN] = "";
+
+        int result = apm_format_tracestate(test->sample_rate, buffer, sizeof(buffer));
+        if (result != test->result || (test->expected && strcmp(buffer, test->expected) != 0)) {
+            printf("tracestate de %g: retorno %d \"%s\", esperado %d \"%s\"\n", test->sample_rate, result, buffer, test->result,
+                   test->expected ? test->expected : "");
+            failures++;
+        }
+    }
+
+    //! toda taxa com até 4 casas sai e volta igual
+    for (int rate = 0; rate <= 10000; rate++) {
+        char buffer[APM_TRACESTATE_LEN];
+        apm_trace_context_t context;
+        if (apm_format_tracestate(rate / 10000.0, buffer, sizeof(buffer)) < 0 || apm_parse_tracestate(buffer, &context) != 0
+            || (int)(context.sample_rate * 10000 + 0.5) != rate) {
+            printf("tracestate da taxa %d/10000 não volta igual: \"%s\"\n", rate, buffer);
+            failures++;
+        }
+    }
+
+    char small[APM_TRACESTATE_LEN - 1];
+    if (apm_format_tracestate(0.5, small, sizeof(small)) != -1) {
+        printf("tracestate formatado em buffer pequeno\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+int main(void)
+{
+    int failures = apm_test_traceparents() + apm_test_tracestates() + apm_test_formats();
+
+    printf("apm_test_traceparent: %d falha(s)\n", failures);
+    return failures ? 1 : 0;
+}